@@ -0,0 +1,384 @@
+//
+//  bench.cpp
+//  Performance benchmarks for Graph on synthetic graphs.
+//
+//  Usage: ./bench [--scale N] [--degree D] [--queries Q] [--graphs rmat,er,grid,chain,star] [--out FILE]
+//  Every graph has about 2^N vertices. Results are printed as a table and
+//  written as JSON (bench.json by default). Cache misses are read from the
+//  hardware counters where perf_event_open() is allowed (-1 otherwise).
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include "graph.cpp"
+
+using namespace std;
+
+// Adjacency lists of a generated graph with keys 0..n-1
+struct GeneratedGraph
+{
+    string name;
+    vector<vector<int>> edges;
+
+    size_t edge_count() const
+    {
+        size_t m = 0;
+        for (const vector<int> &adj : edges) m += adj.size();
+        return m;
+    }
+};
+
+// 1. Generators
+
+// R-MAT (recursive matrix, Kronecker-like): each edge picks a quadrant of the
+// adjacency matrix with probabilities a, b, c, d at every level, giving a
+// skewed, power-law degree distribution
+GeneratedGraph generate_rmat(int scale, int degree, mt19937_64 &rng)
+{
+    const double a = 0.57, b = 0.19, c = 0.19;
+    size_t n = size_t(1) << scale;
+    GeneratedGraph g{"rmat", vector<vector<int>>(n)};
+    uniform_real_distribution<double> coin(0, 1);
+    for (size_t e = 0; e < n * degree; e++)
+    {
+        size_t u = 0, v = 0;
+        for (int level = 0; level < scale; level++)
+        {
+            double p = coin(rng);
+            u = u * 2 + (p >= a + b);
+            v = v * 2 + ((p >= a && p < a + b) || p >= a + b + c);
+        }
+        g.edges[u].push_back(v);
+    }
+    return g;
+}
+
+// Erdős–Rényi G(n, m): m edges with uniformly random endpoints
+GeneratedGraph generate_erdos_renyi(int scale, int degree, mt19937_64 &rng)
+{
+    size_t n = size_t(1) << scale;
+    GeneratedGraph g{"erdos_renyi", vector<vector<int>>(n)};
+    uniform_int_distribution<int> vertex(0, n - 1);
+    for (size_t e = 0; e < n * degree; e++)
+    {
+        g.edges[vertex(rng)].push_back(vertex(rng));
+    }
+    return g;
+}
+
+// 2D grid with edges to the four neighbors
+GeneratedGraph generate_grid(int scale)
+{
+    int side = 1 << (scale / 2);
+    int rows = (size_t(1) << scale) / side;
+    GeneratedGraph g{"grid", vector<vector<int>>(size_t(rows) * side)};
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < side; c++)
+        {
+            vector<int> &adj = g.edges[r * side + c];
+            if (c + 1 < side) adj.push_back(r * side + c + 1);
+            if (r + 1 < rows) adj.push_back((r + 1) * side + c);
+            if (c > 0) adj.push_back(r * side + c - 1);
+            if (r > 0) adj.push_back((r - 1) * side + c);
+        }
+    }
+    return g;
+}
+
+// One long path 0 -> 1 -> ... -> n-1 (worst case for search depth)
+GeneratedGraph generate_chain(int scale)
+{
+    size_t n = size_t(1) << scale;
+    GeneratedGraph g{"chain", vector<vector<int>>(n)};
+    for (size_t i = 0; i + 1 < n; i++)
+    {
+        g.edges[i].push_back(i + 1);
+    }
+    return g;
+}
+
+// Hub 0 pointing at every vertex, and every vertex pointing back at the hub
+GeneratedGraph generate_star(int scale)
+{
+    size_t n = size_t(1) << scale;
+    GeneratedGraph g{"star", vector<vector<int>>(n)};
+    for (size_t i = 1; i < n; i++)
+    {
+        g.edges[0].push_back(i);
+        g.edges[i].push_back(0);
+    }
+    return g;
+}
+
+// 2. Timing
+
+// Hardware cache-miss counter of the calling thread
+class CacheMissCounter
+{
+public:
+    CacheMissCounter()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~CacheMissCounter()
+    {
+        if (fd >= 0) close(fd);
+    }
+
+    // Misses so far, or -1 if the counter is not available
+    long long count() const
+    {
+        long long n = 0;
+        if (fd < 0 || read(fd, &n, sizeof(n)) != sizeof(n)) return -1;
+        return n;
+    }
+
+private:
+    int fd;
+};
+
+// Latencies of one operation in microseconds
+struct OpStats
+{
+    string name;
+    vector<double> micros;
+    size_t edges_per_run = 0; // Edges a run touches, for the throughput figure
+    double misses_per_run = -1; // Cache misses per run (-1 if not measured)
+
+    double percentile(double p) const
+    {
+        vector<double> sorted = micros;
+        sort(sorted.begin(), sorted.end());
+        size_t i = min(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+        return sorted[i];
+    }
+    double median() const { return percentile(0.5); }
+    double p99() const { return percentile(0.99); }
+    double edges_per_second() const { return edges_per_run > 0 ? edges_per_run / (median() / 1e6) : 0; }
+};
+
+// Runs fn runs times and records the latency of each run
+OpStats time_op(const string &name, size_t runs, size_t edges_per_run, const function<void(size_t)> &fn)
+{
+    static CacheMissCounter misses;
+    OpStats stats{name, {}, edges_per_run};
+    long long misses_before = misses.count();
+    for (size_t i = 0; i < runs; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        fn(i);
+        stats.micros.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    if (misses_before >= 0 && runs > 0) stats.misses_per_run = double(misses.count() - misses_before) / runs;
+    return stats;
+}
+
+long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+struct GraphResult
+{
+    string name;
+    size_t vertices;
+    size_t edges;
+    long peak_rss_kb;
+    vector<OpStats> ops;
+    CompressionStats compression;
+};
+
+// 3. Benchmarks of one graph
+
+GraphResult bench_graph(const GeneratedGraph &g, size_t queries, mt19937_64 &rng)
+{
+    size_t n = g.edges.size();
+    size_t m = g.edge_count();
+    vector<int> keys(n), data(n);
+    for (size_t i = 0; i < n; i++)
+    {
+        keys[i] = i;
+        data[i] = i;
+    }
+
+    GraphResult result{g.name, n, m, 0, {}, {}};
+    Graph<int, int> *G = nullptr;
+    result.ops.push_back(time_op("construct", 3, m, [&](size_t) {
+        delete G;
+        G = new Graph<int, int>(keys, data, g.edges);
+    }));
+
+    uniform_int_distribution<int> vertex(0, n - 1);
+    vector<int> sources(queries), targets(queries);
+    for (size_t i = 0; i < queries; i++)
+    {
+        sources[i] = vertex(rng);
+        targets[i] = vertex(rng);
+    }
+
+    // Existing edges for edge_class()
+    vector<pair<int, int>> edges;
+    while (edges.size() < queries && m > 0)
+    {
+        int u = vertex(rng);
+        if (!g.edges[u].empty()) edges.push_back({u, g.edges[u][rng() % g.edges[u].size()]});
+    }
+
+    // print_path() and bfs_tree() write to cout; time them without the output
+    stringstream sink;
+    streambuf *prevbuf = cout.rdbuf(sink.rdbuf());
+
+    size_t full_runs = max<size_t>(1, queries / 10); // Whole-graph traversals are slower
+    result.ops.push_back(time_op("bfs", full_runs, m, [&](size_t i) { G->bfs(sources[i]); }));
+    result.ops.push_back(time_op("dfs", full_runs, m, [&](size_t i) { G->dfs(sources[i]); }));
+    result.ops.push_back(time_op("reachable", queries, 0, [&](size_t i) { G->reachable(sources[i], targets[i]); }));
+    result.ops.push_back(time_op("print_path", queries, 0, [&](size_t i) {
+        G->print_path(sources[i], targets[i]);
+        sink.str("");
+    }));
+    result.ops.push_back(time_op("bfs_tree", full_runs, m, [&](size_t i) {
+        G->bfs_tree(sources[i]);
+        sink.str("");
+    }));
+    G->bfs(sources[0]); // edge_class() classifies against the last bfs() source
+    result.ops.push_back(time_op("edge_class", edges.size(), 0, [&](size_t i) {
+        G->edge_class(edges[i].first, edges[i].second);
+    }));
+
+    // The same traversals after each reorder() of the ids (the runs above use key order)
+    const pair<string, VertexOrder> orders[] = {
+        {"bfs", VertexOrder::BFS}, {"rcm", VertexOrder::RCM}, {"degree", VertexOrder::DEGREE}};
+    for (const auto &[label, order] : orders)
+    {
+        result.ops.push_back(time_op("reorder_" + label, 1, m, [&](size_t) { G->reorder(order); }));
+        result.ops.push_back(time_op("bfs_" + label, full_runs, m, [&](size_t i) { G->bfs(sources[i]); }));
+        result.ops.push_back(time_op("dfs_" + label, full_runs, m, [&](size_t i) { G->dfs(sources[i]); }));
+        result.ops.push_back(time_op("reach_" + label, queries, 0, [&](size_t i) { G->reachable(sources[i], targets[i]); }));
+    }
+    G->reorder(VertexOrder::KEYS);
+
+    // The same traversals over the varint-compressed adjacency
+    result.compression = G->compress();
+    result.ops.push_back(time_op("bfs_packed", full_runs, m, [&](size_t i) { G->bfs(sources[i]); }));
+    result.ops.push_back(time_op("dfs_packed", full_runs, m, [&](size_t i) { G->dfs(sources[i]); }));
+    result.ops.push_back(time_op("tree_packed", full_runs, m, [&](size_t i) {
+        G->bfs_tree(sources[i]);
+        sink.str("");
+    }));
+
+    cout.rdbuf(prevbuf);
+    result.peak_rss_kb = peak_rss_kb();
+    delete G;
+    return result;
+}
+
+// 4. Output
+
+void print_table(const GraphResult &r)
+{
+    cout << r.name << ": " << r.vertices << " vertices, " << r.edges << " edges, peak RSS "
+         << r.peak_rss_kb / 1024 << " MB" << endl;
+    cout << "  adjacency      " << r.compression.plain_bytes_per_edge() << " bytes/edge, compressed "
+         << r.compression.compressed_bytes_per_edge() << " bytes/edge (" << r.compression.ratio() << "x)" << endl;
+    for (const OpStats &op : r.ops)
+    {
+        cout << "  " << op.name << string(15 - min<size_t>(14, op.name.size()), ' ')
+             << "median " << op.median() << " us, p99 " << op.p99() << " us";
+        if (op.edges_per_run > 0) cout << ", " << op.edges_per_second() / 1e6 << " M edges/s";
+        if (op.misses_per_run >= 0) cout << ", " << op.misses_per_run << " misses/run";
+        cout << endl;
+    }
+}
+
+void write_json(const string &path, int scale, int degree, const vector<GraphResult> &results)
+{
+    ofstream out(path);
+    out << "{\n  \"scale\": " << scale << ",\n  \"degree\": " << degree << ",\n  \"graphs\": [";
+    for (size_t g = 0; g < results.size(); g++)
+    {
+        const GraphResult &r = results[g];
+        out << (g > 0 ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"vertices\": " << r.vertices
+            << ", \"edges\": " << r.edges << ", \"peak_rss_kb\": " << r.peak_rss_kb
+            << ", \"bytes_per_edge\": " << r.compression.plain_bytes_per_edge()
+            << ", \"compressed_bytes_per_edge\": " << r.compression.compressed_bytes_per_edge() << ", \"ops\": {";
+        for (size_t i = 0; i < r.ops.size(); i++)
+        {
+            const OpStats &op = r.ops[i];
+            out << (i > 0 ? ", " : "") << "\n      \"" << op.name << "\": {\"runs\": " << op.micros.size()
+                << ", \"median_us\": " << op.median() << ", \"p99_us\": " << op.p99()
+                << ", \"edges_per_sec\": " << op.edges_per_second()
+                << ", \"cache_misses_per_run\": " << op.misses_per_run << "}";
+        }
+        out << "\n    }}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+    int scale = 14;
+    int degree = 8;
+    size_t queries = 200;
+    string graphs = "rmat,er,grid,chain,star";
+    string out_path = "bench.json";
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        string flag = argv[i];
+        if (flag == "--scale") scale = stoi(argv[i + 1]);
+        else if (flag == "--degree") degree = stoi(argv[i + 1]);
+        else if (flag == "--queries") queries = stoul(argv[i + 1]);
+        else if (flag == "--graphs") graphs = argv[i + 1];
+        else if (flag == "--out") out_path = argv[i + 1];
+        else
+        {
+            cerr << "Unknown option " << flag << endl;
+            return 1;
+        }
+    }
+
+    mt19937_64 rng(42);
+    vector<GraphResult> results;
+    stringstream names(graphs);
+    string name;
+    while (getline(names, name, ','))
+    {
+        GeneratedGraph g;
+        if (name == "rmat") g = generate_rmat(scale, degree, rng);
+        else if (name == "er") g = generate_erdos_renyi(scale, degree, rng);
+        else if (name == "grid") g = generate_grid(scale);
+        else if (name == "chain") g = generate_chain(scale);
+        else if (name == "star") g = generate_star(scale);
+        else
+        {
+            cerr << "Unknown graph " << name << endl;
+            return 1;
+        }
+        results.push_back(bench_graph(g, queries, rng));
+        print_table(results.back());
+    }
+
+    write_json(out_path, scale, degree, results);
+    cout << "Wrote " << out_path << endl;
+    return 0;
+}
@@ -5,16 +5,174 @@
 // ========================================
 
 template <typename D, typename K>
-Graph<D, K>::Graph() { 
+Graph<D, K>::Graph() {
+    rebuild();
 }
 
 template <typename D, typename K>
-Graph<D, K>::Graph(vector<K> keys, vector<D> data, vector<vector<K>> edges)
+Graph<D, K>::Graph(const vector<K> &keys, const vector<D> &data, const vector<vector<K>> &edges)
 {
     for (size_t i = 0; i < keys.size(); i++) {
-    vertices[keys[i]] = new Vertex<D, K>(keys[i], data[i]);
-    vertices[keys[i]]->adj = edges[i];
+    Vertex<D, K> *&slot = vertices[keys[i]];
+    delete slot; // Duplicate key: the later one wins
+    slot = new Vertex<D, K>(keys[i], data[i]);
+    slot->adj = edges[i];
 }
+    rebuild();
+}
+
+template <typename D, typename K>
+Graph<D, K>::Graph(const vector<K> &keys, const vector<D> &data, const vector<vector<K>> &edges,
+                   const vector<vector<double>> &weights)
+{
+    for (size_t i = 0; i < keys.size(); i++) {
+        Vertex<D, K> *&slot = vertices[keys[i]];
+        delete slot; // Duplicate key: the later one wins
+        slot = new Vertex<D, K>(keys[i], data[i]);
+        slot->adj = edges[i];
+        if (i < weights.size()) slot->weights = weights[i];
+    }
+    rebuild();
+}
+
+template <typename D, typename K>
+Graph<D, K> *Graph<D, K>::load_adjacency_list(const string &path, function<D(const K &)> make_data,
+                                              LoadStats *stats, function<void(size_t, size_t)> progress)
+{
+    MappedFile file(path);
+    if (!file.is_open()) return nullptr;
+    file.advise_sequential();
+    return load_adjacency_list(file.data(), file.size(), make_data, stats, progress);
+}
+
+template <typename D, typename K>
+Graph<D, K> *Graph<D, K>::load_adjacency_list(istream &in, function<D(const K &)> make_data,
+                                              LoadStats *stats, function<void(size_t, size_t)> progress)
+{
+    // Streams cannot be mapped, so read them into one buffer first
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    return load_adjacency_list(text.data(), text.size(), make_data, stats, progress);
+}
+
+// Precondition: text holds size bytes of "key:neighbor,neighbor" lines
+// Postcondition: returns a new graph with one vertex per line; a later line
+//                with the same key replaces the earlier one. Returns nullptr
+//                if a key does not parse, with its line in stats->error_line.
+
+template <typename D, typename K>
+Graph<D, K> *Graph<D, K>::load_adjacency_list(const char *text, size_t size, function<D(const K &)> make_data,
+                                              LoadStats *stats, function<void(size_t, size_t)> progress)
+{
+    auto start = chrono::steady_clock::now();
+
+    // Split into chunks that end on line boundaries
+    size_t workers = max(1u, thread::hardware_concurrency());
+    size_t chunk_size = max<size_t>(1 << 20, size / (workers * 4) + 1);
+    vector<size_t> bounds = {0};
+    while (bounds.back() < size) {
+        size_t end = min(size, bounds.back() + chunk_size);
+        while (end < size && text[end - 1] != '\n') end++;
+        bounds.push_back(end);
+    }
+    size_t chunks = bounds.size() - 1;
+
+    // Each chunk turns its lines directly into vertices; the graph takes
+    // them over at the end
+    Graph *G = new Graph();
+    vector<vector<Vertex<D, K> *>> parsed(chunks);
+    vector<size_t> chunk_edges(chunks, 0);
+    vector<size_t> chunk_lines(chunks, 0);
+    vector<size_t> chunk_error(chunks, 0); // Line within the chunk (from 1), 0 if none
+    size_t bytes_done = 0;
+    mutex progress_lock;
+
+    ThreadPool::shared().run(chunks, [&](size_t c) {
+        const char *p = text + bounds[c];
+        const char *end = text + bounds[c + 1];
+        while (p < end && chunk_error[c] == 0) {
+            const char *eol = static_cast<const char *>(memchr(p, '\n', end - p));
+            if (eol == nullptr) eol = end;
+            const char *line_end = eol;
+            if (line_end > p && line_end[-1] == '\r') line_end--;
+            chunk_lines[c]++;
+
+            if (!trim_token(string_view(p, line_end - p)).empty()) {
+                const char *colon = static_cast<const char *>(memchr(p, ':', line_end - p));
+                if (colon == nullptr) colon = line_end; // Key without neighbors
+
+                K key{};
+                if (!parse_key(string_view(p, colon - p), key)) {
+                    chunk_error[c] = chunk_lines[c];
+                    break;
+                }
+                Vertex<D, K> *v = new Vertex<D, K>(key, make_data ? make_data(key) : D());
+                parsed[c].push_back(v);
+
+                // Neighbor tokens are separated by ','; empty tokens are skipped
+                const char *token = colon + 1;
+                while (token < line_end) {
+                    const char *comma = static_cast<const char *>(memchr(token, ',', line_end - token));
+                    if (comma == nullptr) comma = line_end;
+                    string_view neighbor(token, comma - token);
+                    if (!trim_token(neighbor).empty()) {
+                        if (!parse_key(neighbor, key)) {
+                            chunk_error[c] = chunk_lines[c];
+                            break;
+                        }
+                        v->adj.push_back(key);
+                    }
+                    token = comma + 1;
+                }
+                chunk_edges[c] += v->adj.size();
+            }
+            p = eol + 1;
+        }
+
+        if (progress) {
+            lock_guard<mutex> lock(progress_lock);
+            bytes_done += bounds[c + 1] - bounds[c];
+            progress(bytes_done, size);
+        }
+    });
+
+    // A malformed line fails the whole load; earlier chunks ran to their end,
+    // so their line counts place it in the text
+    size_t lines_before = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        if (chunk_error[c] == 0) {
+            lines_before += chunk_lines[c];
+            continue;
+        }
+        for (auto &vertices_of_chunk : parsed) {
+            for (Vertex<D, K> *v : vertices_of_chunk) delete v;
+        }
+        delete G;
+        if (stats != nullptr) {
+            *stats = LoadStats();
+            stats->bytes = size;
+            stats->error_line = lines_before + chunk_error[c];
+        }
+        return nullptr;
+    }
+
+    size_t edges = 0;
+    for (size_t c = 0; c < chunks; c++) {
+        for (Vertex<D, K> *v : parsed[c]) {
+            Vertex<D, K> *&slot = G->vertices[v->key];
+            delete slot; // Duplicate key: the later line wins
+            slot = v;
+        }
+        edges += chunk_edges[c];
+    }
+    G->rebuild();
+
+    if (stats != nullptr) {
+        stats->bytes = size;
+        stats->vertices = G->vertices.size();
+        stats->edges = edges;
+        stats->seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    return G;
 }
 
 template <typename D, typename K>
@@ -37,14 +195,26 @@ G.get(k) should return a pointer to the vertex corresponding to the key k in the
 template <typename D, typename K>
 Vertex<D, K> *Graph<D, K>::get(K key)
 {
-    // find key on vertices map 
-    auto it = vertices.find(key);
+    GRAPH_STATS_CALL("get");
+    GRAPH_STATS_ADD(lookups, 1);
+    GRAPH_STATS_PHASE(lookup);
+
+    // Hash lookup of the dense id first
+    int id = index_find(key);
+    if (id >= 0) return id_to_vertex[id];
 
-    // return pointer to vertex if found, else nullptr
+    // Then the vertices map, which also holds vertices added directly since
+    // the last rebuild(); return pointer to vertex if found, else nullptr
+    auto it = vertices.find(key);
     if (it != vertices.end()) // If key was found
     {
         return it->second; // Return its pointer (it->first is the key, it->second is the value)
     }
+    if (snapshot) // Not materialized yet
+    {
+        id = snapshot_find(key);
+        if (id >= 0) return vertex_at(id);
+    }
     return nullptr;
 }
 
@@ -58,16 +228,22 @@ Should only print the string "X is reachable from T"
 template <typename D, typename K>
 bool Graph<D, K>::reachable(K u, K v)
 {
-    // Perform BFS from u
-    bfs(u);
-    // Check if v was reached
-    Vertex<D, K>* target = get(v);
-    // Return true if target != nullptr and target->distance != -1, false otherwise
-    if (target != nullptr && target->distance != -1)
+    GRAPH_STATS_CALL("reachable");
+    if (has_reachability_index())
     {
-        return true;
+        int u_id = id_of(u);
+        int v_id = id_of(v);
+        return u_id >= 0 && v_id >= 0 && index_reachable(u_id, v_id);
     }
-    return false;
+
+    int source = id_of(u);
+    int target = id_of(v);
+    if (source < 0 || target < 0) return false;
+
+    // Search from both ends until the frontiers meet (scratch results reused
+    // by every query on this thread)
+    static thread_local BfsResult forward, backward;
+    return bidirectional_search(source, target, forward, backward) != -1;
 }
 
 /*
@@ -80,272 +256,3233 @@ corresponding to the key value s.
 
 template <typename D, typename K>
 void Graph<D, K>::bfs(K s)
+{
+    GRAPH_STATS_CALL("bfs");
+    static thread_local BfsResult r;
+    bfs_result(s, r);
+    record_bfs(r);
+}
+
+// Precondition: r is a BFS (possibly stopped early) of the current graph
+// Postcondition: the BFS properties of the vertices r reached are copied into
+//                them and every other vertex is reset (compatibility mode)
+
+template <typename D, typename K>
+void Graph<D, K>::record_bfs(const BfsResult &r)
 {
     reset_bfs_state();
-    Vertex<D, K> *source = get(s);
-    if (source == nullptr) return;
+    for (int id : r.order) {
+        Vertex<D, K> *v = vertex_at(id);
+        v->visited = true;
+        v->distance = r.distance(id);
+        v->pi = r.parent(id) < 0 ? K() : key_of(r.parent(id));
+    }
+    bfs_touched = r.order;
+    bfs_source = r.source;
+}
+
+// Precondition: none
+// Postcondition: returns distances, predecessors and discovery order from s;
+//                the graph is not modified
+
+template <typename D, typename K>
+BfsResult Graph<D, K>::bfs_result(K s) const
+{
+    BfsResult r;
+    bfs_result(s, r);
+    return r;
+}
+
+// Precondition: none
+// Postcondition: r holds the BFS from s; runs in time proportional to the
+//                part of the graph reachable from s
+
+template <typename D, typename K>
+void Graph<D, K>::bfs_result(K s, BfsResult &r) const
+{
+    GRAPH_STATS_CALL("bfs_result");
+    bfs_from(id_of(s), -1, r);
+}
 
-    source->distance = 0;
-    source->visited = true; // Mark source as visited immediately
-    queue<K> q;
-    q.push(s);
+// Precondition: src is a vertex id or -1; target is a vertex id or -1
+// Postcondition: r holds the BFS from src. With a target the search stops as
+//                soon as the target is discovered; the target's distance and
+//                parents are the same as in a full search.
 
-    while (!q.empty())
+template <typename D, typename K>
+void Graph<D, K>::bfs_from(int src, int target, BfsResult &r) const
+{
     {
-        K u_key = q.front();
-        q.pop();
+        GRAPH_STATS_PHASE(reset);
+        r.begin(id_to_vertex.size());
+    }
+    if (src < 0) return;
 
-        Vertex<D, K> *u = get(u_key);
+    GRAPH_STATS_PHASE(search);
+    r.source = src;
+    r.visit(src, 0, -1); // Mark source as visited immediately
+    GRAPH_STATS_ADD(vertices_visited, 1);
+    if (src == target) return;
 
-        for (size_t i = 0; i < u->adj.size(); i++) {
-            K v_key = u->adj[i];
-            Vertex<D, K> *v = get(v_key);
-            if (v == nullptr) continue;
+    unsigned workers = get_threads();
+    if (target < 0 && workers > 1 && id_to_vertex.size() >= parallel_min_vertices && !compressed) {
+        bfs_parallel(r, workers);
+        return;
+    }
 
-            if (!v->visited) // If v is unvisited
-            {
-                v->visited = true; // Mark v as visited
-                v->distance = u->distance + 1;
-                v->pi = u_key;
-                q.push(v_key);
+    with_rows([&](const auto &out, const auto &) {
+        // order doubles as the queue; head walks forward instead of popping
+        for (size_t head = 0; head < r.order.size(); head++)
+        {
+            int u = r.order[head];
+            int next_distance = r.dist[u] + 1;
+            GRAPH_STATS_MAX(queue_peak, r.order.size() - head);
+
+            for (int v : out.row(u)) {
+                GRAPH_STATS_ADD(edges_scanned, 1);
+
+                if (!r.reached(v)) // If v is unvisited
+                {
+                    r.visit(v, next_distance, u);
+                    GRAPH_STATS_ADD(vertices_visited, 1);
+                    if (v == target) return;
+                }
             }
         }
+    });
+}
+
+// Precondition: none
+// Postcondition: returns a shortest path from u to v (keys, u first), or an
+//                empty vector if v is unreachable or a key is missing
+
+template <typename D, typename K>
+vector<K> Graph<D, K>::bidirectional_path(K u, K v) const
+{
+    GRAPH_STATS_CALL("bidirectional_path");
+    int source = id_of(u);
+    int target = id_of(v);
+    if (source < 0 || target < 0) return {};
+
+    static thread_local BfsResult forward, backward;
+    int meet = bidirectional_search(source, target, forward, backward);
+    if (meet < 0) return {};
+
+    // Forward parents lead back to the source, backward parents on to the target
+    vector<K> path;
+    for (int x = meet; x != -1; x = forward.parent(x)) {
+        path.push_back(key_of(x));
+    }
+    reverse(path.begin(), path.end());
+    for (int x = backward.parent(meet); x != -1; x = backward.parent(x)) {
+        path.push_back(key_of(x));
     }
+    return path;
 }
 
-/*
-G.print_path(u, v) should print the shortest path from the vertex corresponding to the key u to the vertex corresponding to the key v in the graph G.
-If there is no path from u to v, the function should not print anything.
-*/
+// Bidirectional BFS: forward over out-edges from source, backward over
+// in-edges from target, always growing the side with the smaller frontier by
+// one whole level.
+// Precondition: source and target are vertex ids
+// Postcondition: returns a vertex on a shortest source-target path (-1 if none);
+//                forward.distance(meet) + backward.distance(meet) is its length
 
-// Precondition: keys u and v exist in graph G
-// Postcondition: prints shortest path from u to v if exists
+template <typename D, typename K>
+int Graph<D, K>::bidirectional_search(int source, int target, BfsResult &forward, BfsResult &backward) const
+{
+    size_t n = id_to_vertex.size();
+    {
+        GRAPH_STATS_PHASE(reset);
+        forward.begin(n);
+        backward.begin(n);
+    }
+    GRAPH_STATS_PHASE(search);
+    GRAPH_STATS_ADD(vertices_visited, source == target ? 1 : 2);
+    forward.source = source;
+    backward.source = target;
+    forward.visit(source, 0, -1);
+    backward.visit(target, 0, -1);
+    if (source == target) return source;
+
+    return with_rows([&](const auto &out, const auto &in) {
+        size_t forward_begin = 0;
+        size_t backward_begin = 0;
+        while (forward_begin < forward.order.size() && backward_begin < backward.order.size())
+        {
+            bool grow_forward = forward.order.size() - forward_begin <= backward.order.size() - backward_begin;
+            BfsResult &side = grow_forward ? forward : backward;
+            BfsResult &other = grow_forward ? backward : forward;
+            const auto &side_rows = grow_forward ? out : in;
+            size_t &begin = grow_forward ? forward_begin : backward_begin;
+
+            // Expand the whole level, keeping the shortest meeting point found
+            int meet = -1;
+            int best = 0;
+            size_t end = side.order.size();
+            GRAPH_STATS_MAX(queue_peak, end - begin);
+            for (size_t i = begin; i < end; i++) {
+                int x = side.order[i];
+                for (int y : side_rows.row(x)) {
+                    GRAPH_STATS_ADD(edges_scanned, 1);
+                    if (side.reached(y)) continue;
+
+                    side.visit(y, side.dist[x] + 1, x);
+                    GRAPH_STATS_ADD(vertices_visited, 1);
+                    if (other.reached(y) && (meet == -1 || side.dist[y] + other.dist[y] < best)) {
+                        meet = y;
+                        best = side.dist[y] + other.dist[y];
+                    }
+                }
+            }
+            begin = end;
+            if (meet != -1) return meet;
+        }
+        return -1;
+    });
+}
+
+// Level-synchronous BFS split across the shared thread pool.
+// Precondition: r holds only the source
+// Postcondition: r matches the single-thread BFS exactly (same order and parents)
 
 template <typename D, typename K>
-void Graph<D, K>::print_path(K u, K v)
+void Graph<D, K>::bfs_parallel(BfsResult &r, unsigned workers) const
 {
-    bfs(u); // Perform BFS from u to set up pi values
-    
-    Vertex<D, K>* target = get(v); // Get target vertex
-    if (target == nullptr || target->distance == -1) {
-        return;
+    size_t n = id_to_vertex.size();
+
+    // claim[v] = (query epoch << 32) | frontier position of v's best parent so far
+    static thread_local unique_ptr<atomic<uint64_t>[]> claim;
+    static thread_local size_t claim_size = 0;
+    static thread_local uint64_t claim_epoch = 0;
+    if (claim_size < n || ++claim_epoch == (1ull << 32)) {
+        claim.reset(new atomic<uint64_t>[n]);
+        for (size_t i = 0; i < n; i++) {
+            claim[i].store(0, memory_order_relaxed);
+        }
+        claim_size = n;
+        claim_epoch = 1;
     }
-    
-    vector<K> path; // To store the path
-    K current = v;   // Start from target vertex
-    
-    while (current != u) {
-        path.push_back(current);
-        Vertex<D, K>* curr_vertex = get(current);
-        if (curr_vertex == nullptr) break;
-        current = curr_vertex->pi;
-    }
-    path.push_back(u);
-    
-    for (int i = path.size() - 1; i >= 0; i--) {
-        cout << path[i];
-        if (i > 0) cout << " -> ";
+
+    // Locals, because pool threads would see their own thread_local copies
+    atomic<uint64_t> *claims = claim.get();
+    uint64_t epoch = claim_epoch;
+
+    ThreadPool &pool = ThreadPool::shared();
+    vector<vector<int>> next(workers); // Per-thread next-frontier buffers
+
+    size_t level_begin = 0;
+    for (int level = 0; level_begin < r.order.size(); level++)
+    {
+        size_t level_end = r.order.size();
+        size_t frontier = level_end - level_begin;
+        GRAPH_STATS_MAX(queue_peak, frontier);
+#ifdef GRAPH_STATS
+        // Counted here because pool threads have their own counters
+        for (size_t pos = level_begin; pos < level_end; pos++) {
+            GRAPH_STATS_ADD(edges_scanned, ends[r.order[pos]] - offsets[r.order[pos]]);
+        }
+#endif
+
+        if (frontier < PARALLEL_MIN_FRONTIER) {
+            for (size_t pos = level_begin; pos < level_end; pos++) {
+                int u = r.order[pos];
+                for (size_t e = offsets[u]; e < ends[u]; e++) {
+                    if (!r.reached(neighbors[e])) r.visit(neighbors[e], level + 1, u);
+                }
+            }
+            level_begin = level_end;
+            continue;
+        }
+
+        size_t chunk = (frontier + workers - 1) / workers;
+
+        // Phase 1: frontier vertices claim unvisited neighbors with a CAS loop.
+        // The lowest frontier position wins, which is the parent the
+        // single-thread queue would have picked.
+        pool.run(workers, [&](size_t t) {
+            size_t lo = level_begin + t * chunk;
+            size_t hi = min(level_end, lo + chunk);
+            for (size_t pos = lo; pos < hi; pos++) {
+                int u = r.order[pos];
+                uint64_t tag = (epoch << 32) | pos;
+                for (size_t e = offsets[u]; e < ends[u]; e++) {
+                    int v = neighbors[e];
+                    if (r.reached(v)) continue;
+
+                    uint64_t cur = claims[v].load(memory_order_relaxed);
+                    while ((cur >> 32) != epoch || cur > tag) {
+                        if (claims[v].compare_exchange_weak(cur, tag, memory_order_relaxed)) break;
+                    }
+                }
+            }
+        });
+
+        // Phase 2: each winner appends its vertices to its own buffer in
+        // adjacency order; buffers are merged in frontier order below
+        pool.run(workers, [&](size_t t) {
+            next[t].clear();
+            size_t lo = level_begin + t * chunk;
+            size_t hi = min(level_end, lo + chunk);
+            for (size_t pos = lo; pos < hi; pos++) {
+                int u = r.order[pos];
+                uint64_t tag = (epoch << 32) | pos;
+                for (size_t e = offsets[u]; e < ends[u]; e++) {
+                    int v = neighbors[e];
+                    if (claims[v].load(memory_order_relaxed) == tag && !r.reached(v)) {
+                        r.mark(v, level + 1, u);
+                        next[t].push_back(v);
+                    }
+                }
+            }
+        });
+
+        for (unsigned t = 0; t < workers; t++) {
+            r.order.insert(r.order.end(), next[t].begin(), next[t].end());
+        }
+        level_begin = level_end;
     }
+    GRAPH_STATS_ADD(vertices_visited, r.order.size() - 1);
 }
 
-/*
-G.edge_class(u, v) should classify the edge (u, v) in the graph G as one of the following types: "tree edge", "back edge", "forward edge",
-"cross edge", or "no edge".
-*/
-// Precondition: keys u and v exist in graph G
-// Postcondition: returns string representing edge classification
+// Precondition: none
+// Postcondition: returns reachable(u, v) for every (u, v) in pairs, in order
 
 template <typename D, typename K>
-string Graph<D, K>::edge_class(K u, K v)
+vector<bool> Graph<D, K>::reachable_batch(const vector<pair<K, K>> &pairs) const
 {
-    Vertex<D, K>* u_vertex = get(u);
-    if (u_vertex == nullptr) return "no edge";
-    
-    // Check if edge exists
-    bool edge_exists = false;
-    for (K adj_key : u_vertex->adj) {
-        if (adj_key == v) {
-            edge_exists = true;
-            break;
-        }
+    vector<int> distances = distance_batch(pairs);
+    vector<bool> result(distances.size());
+    for (size_t i = 0; i < distances.size(); i++) {
+        result[i] = distances[i] != -1;
     }
-    if (!edge_exists) return "no edge";
-    
-    // Find source from last BFS (vertex with distance 0)
-    K source = find_source();
-    if (source != K()) {
-        dfs(source);
-    } else {
-        return "no edge";
+    return result;
+}
+
+// Precondition: none
+// Postcondition: returns the BFS distance from u to v for every (u, v) in
+//                pairs, in order (-1 if v is unreachable or a key is missing)
+
+template <typename D, typename K>
+vector<int> Graph<D, K>::distance_batch(const vector<pair<K, K>> &pairs) const
+{
+    vector<int> result(pairs.size(), -1);
+
+    vector<BatchQuery> queries;
+    queries.reserve(pairs.size());
+    for (size_t i = 0; i < pairs.size(); i++) {
+        int u = id_of(pairs[i].first);
+        int v = id_of(pairs[i].second);
+        if (u >= 0 && v >= 0) queries.push_back({u, v, i});
     }
 
+    // Queries sharing a source become one bit; split into groups of 64 sources
+    sort(queries.begin(), queries.end(),
+         [](const BatchQuery &a, const BatchQuery &b) { return a.source < b.source; });
 
-    Vertex<D, K>* v_vertex = get(v);
-    if (v_vertex == nullptr) {
-        return "no edge";
+    vector<size_t> group_begin;
+    int sources_in_group = 0;
+    for (size_t i = 0; i < queries.size(); i++) {
+        if (i > 0 && queries[i].source == queries[i - 1].source) continue;
+        if (sources_in_group % 64 == 0) group_begin.push_back(i);
+        sources_in_group++;
     }
-    
-    // Tree edge: v.π = u
-    if (v_vertex->pi == u) {
-        return "tree edge";
+    group_begin.push_back(queries.size());
+
+    size_t groups = group_begin.size() - 1;
+    auto run_group = [&](size_t g) {
+        distance_batch_group(&queries[group_begin[g]], group_begin[g + 1] - group_begin[g], result);
+    };
+    if (groups > 1 && get_threads() > 1) {
+        ThreadPool::shared().run(groups, run_group);
+    } else {
+        for (size_t g = 0; g < groups; g++) run_group(g);
     }
-    
-    // Back edge: edge to ancestor (v's interval contains u's interval)
-    if (v_vertex->discovery_time < u_vertex->discovery_time && 
-        u_vertex->finish_time < v_vertex->finish_time) {
-        return "back edge";
+    return result;
+}
+
+// Bit-parallel BFS for up to 64 distinct sources (queries sorted by source).
+// Stops as soon as every query of the group has its answer.
+
+template <typename D, typename K>
+void Graph<D, K>::distance_batch_group(const BatchQuery *queries, size_t count, vector<int> &result) const
+{
+    size_t n = id_to_vertex.size();
+
+    // Per-thread scratch; only the vertices in touched are non-zero between calls
+    static thread_local vector<uint64_t> seen, frontier_bits, next_bits;
+    static thread_local vector<int> target_head;
+    static thread_local EpochStamps is_target;
+    if (seen.size() < n) {
+        seen.resize(n, 0);
+        frontier_bits.resize(n, 0);
+        next_bits.resize(n, 0);
+        target_head.resize(n);
     }
-    
-    // Forward edge: edge to descendant (u's interval contains v's interval)
-    if (u_vertex->discovery_time < v_vertex->discovery_time && 
-        v_vertex->finish_time < u_vertex->finish_time) {
-        return "forward edge";
+    is_target.next(n);
+
+    vector<int> touched, frontier, next_frontier;
+    vector<uint64_t> query_bit(count);
+    vector<int> next_query(count, -1); // Queries sharing a target form a linked list
+    size_t unresolved = 0;
+
+    int bit = -1;
+    for (size_t q = 0; q < count; q++) {
+        const BatchQuery &query = queries[q];
+        if (q == 0 || query.source != queries[q - 1].source) {
+            bit++;
+            if (seen[query.source] == 0) touched.push_back(query.source);
+            seen[query.source] |= 1ull << bit;
+            if (frontier_bits[query.source] == 0) frontier.push_back(query.source);
+            frontier_bits[query.source] |= 1ull << bit;
+        }
+        query_bit[q] = 1ull << bit;
+
+        if (query.target == query.source) {
+            result[query.index] = 0;
+            continue;
+        }
+        if (!is_target.current(query.target)) {
+            is_target.mark(query.target);
+            target_head[query.target] = -1;
+        }
+        next_query[q] = target_head[query.target];
+        target_head[query.target] = q;
+        unresolved++;
     }
-    
-    // Cross edge: everything else
-    return "cross edge";
+
+    for (int level = 1; !frontier.empty() && unresolved > 0; level++)
+    {
+        // Expand every source at once: one scan of each adjacency list per level
+        with_rows([&](const auto &out, const auto &) {
+            for (int u : frontier) {
+                uint64_t bits = frontier_bits[u];
+                frontier_bits[u] = 0;
+                for (int v : out.row(u)) {
+                    uint64_t fresh = bits & ~seen[v];
+                    if (fresh == 0) continue;
+
+                    if (seen[v] == 0) touched.push_back(v);
+                    seen[v] |= fresh;
+                    if (next_bits[v] == 0) next_frontier.push_back(v);
+                    next_bits[v] |= fresh;
+                }
+            }
+        });
+
+        // Answer the queries whose target was reached on this level
+        for (int v : next_frontier) {
+            if (!is_target.current(v)) continue;
+            for (int q = target_head[v]; q != -1; q = next_query[q]) {
+                if ((next_bits[v] & query_bit[q]) && result[queries[q].index] == -1) {
+                    result[queries[q].index] = level;
+                    unresolved--;
+                }
+            }
+        }
+
+        frontier.swap(next_frontier);
+        next_frontier.clear();
+        frontier_bits.swap(next_bits);
+    }
+
+    // Leave the scratch arrays zeroed for the next group
+    for (int v : touched) seen[v] = 0;
+    for (int v : frontier) frontier_bits[v] = 0;
 }
 
+// Precondition: none
+// Postcondition: component[id] holds the strongly connected component of every
+//                vertex; returns the number of components. Components are
+//                numbered in reverse topological order (sinks first).
 
-/*
-bfs_tree(s): G.bfs_tree(s) should perform a breadth-first search (BFS) traversal of the graph G starting from the source vertex corresponding to the key s and print the vertices level by level.
-*/
-// Precondition: key s exists in graph G
-// Postcondition: prints vertices level by level from source s
+template <typename D, typename K>
+int Graph<D, K>::strongly_connected(vector<int> &component) const
+{
+    // Iterative Tarjan: frames hold (vertex, next edge) instead of recursing
+    size_t n = id_to_vertex.size();
+    vector<int> index(n, -1), lowlink(n, 0);
+    vector<bool> on_stack(n, false);
+    vector<int> stack;
+    vector<pair<int, size_t>> frames;
+    component.assign(n, -1);
+
+    // Roots are tried in key order, so the numbering does not depend on the ids
+    int counter = 0;
+    int count = 0;
+    for_each_id([&](int s) {
+        if (index[s] != -1) return;
+
+        index[s] = lowlink[s] = counter++;
+        stack.push_back(s);
+        on_stack[s] = true;
+        frames.push_back({s, offsets[s]});
+
+        while (!frames.empty()) {
+            int v = frames.back().first;
+            size_t &e = frames.back().second;
+
+            if (e < ends[v]) {
+                int w = neighbors[e++];
+                if (index[w] == -1) {
+                    index[w] = lowlink[w] = counter++;
+                    stack.push_back(w);
+                    on_stack[w] = true;
+                    frames.push_back({w, offsets[w]});
+                } else if (on_stack[w]) {
+                    lowlink[v] = min(lowlink[v], index[w]);
+                }
+                continue;
+            }
+
+            frames.pop_back();
+            if (lowlink[v] == index[v]) {
+                // v is the root of a component: pop it off the stack
+                int w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    on_stack[w] = false;
+                    component[w] = count;
+                } while (w != v);
+                count++;
+            }
+            if (!frames.empty()) {
+                int parent = frames.back().first;
+                lowlink[parent] = min(lowlink[parent], lowlink[v]);
+            }
+        }
+    });
+    return count;
+}
+
+// Precondition: none
+// Postcondition: reachable() answers from the index until the graph changes
 
 template <typename D, typename K>
-void Graph<D, K>::bfs_tree(K s)
+void Graph<D, K>::build_reachability_index()
 {
-    reset_bfs_state();
-    Vertex<D, K> *source = get(s);
-    if (source == nullptr) return;
-
-    source->distance = 0;
-    source->visited = true; // Mark source as visited immediately
-    
-    queue<K> q;
-    q.push(s);
-    
-    map<int, vector<K>> levels;
-    levels[0].push_back(s); 
-
-    while (!q.empty()) {
-        K u_key = q.front();
-        q.pop();
-        
-        Vertex<D, K> *u = get(u_key);
-
-        for (auto v_key : u->adj) {
-            Vertex<D, K> *v = get(v_key);
-            if (v == nullptr) continue;
-            
-            if (!v->visited) { // If v is unvisited
-                v->visited = true; // Mark v as visited
-                v->distance = u->distance + 1;
-                v->pi = u_key;
-                
-                levels[v->distance].push_back(v_key); // Add v to its level
-                q.push(v_key);
-            }
-        }
-    }
-
-    // Print levels
-    int total_levels = levels.size();
-    int current_level_index = 0;
-    
-    for (auto& level_pair : levels) {
-        vector<K>& level_vertices = level_pair.second;
-        
-        for (int i = 0; i < level_vertices.size(); i++) {
-            cout << level_vertices[i];
-            if (i < level_vertices.size() - 1) cout << " ";
-        }
-        
-        current_level_index++;
-        if (current_level_index < total_levels) {
-            cout << endl;
+    decompress();
+    ReachabilityIndex &ix = reach_index;
+    ix.components = strongly_connected(ix.component);
+    int c = ix.components;
+
+    vector<vector<int>> dag = component_edges(ix.component, c);
+    ix.dag_offsets.assign(c + 1, 0);
+    ix.dag_targets.clear();
+    for (int x = 0; x < c; x++) {
+        ix.dag_targets.insert(ix.dag_targets.end(), dag[x].begin(), dag[x].end());
+        ix.dag_offsets[x + 1] = ix.dag_targets.size();
+    }
+
+    // Two DFS passes over the DAG, the second visiting roots and children in
+    // reverse order so the two [low, post] labels prune different pairs
+    ix.pre.assign(c, 0);
+    vector<pair<int, size_t>> frames;
+    for (int pass = 0; pass < ReachabilityIndex::LABELS; pass++) {
+        vector<int> &post = ix.post[pass];
+        vector<int> &low = ix.low[pass];
+        post.assign(c, -1);
+        low.assign(c, 0);
+        int pre_rank = 0;
+        int post_rank = 0;
+
+        for (int i = 0; i < c; i++) {
+            int root = pass == 0 ? i : c - 1 - i;
+            if (post[root] != -1 || low[root] == -1) continue;
+
+            low[root] = -1; // -1 marks "on the current DFS path"
+            if (pass == 0) ix.pre[root] = pre_rank++;
+            frames.push_back({root, 0});
+
+            while (!frames.empty()) {
+                int x = frames.back().first;
+                size_t &i_child = frames.back().second;
+                size_t degree = ix.dag_offsets[x + 1] - ix.dag_offsets[x];
+
+                if (i_child < degree) {
+                    size_t k = pass == 0 ? i_child : degree - 1 - i_child;
+                    int y = ix.dag_targets[ix.dag_offsets[x] + k];
+                    i_child++;
+                    if (post[y] == -1 && low[y] != -1) {
+                        low[y] = -1;
+                        if (pass == 0) ix.pre[y] = pre_rank++;
+                        frames.push_back({y, 0});
+                    }
+                    continue;
+                }
+
+                frames.pop_back();
+                post[x] = post_rank++;
+                low[x] = post[x];
+                for (size_t e = ix.dag_offsets[x]; e < ix.dag_offsets[x + 1]; e++) {
+                    low[x] = min(low[x], low[ix.dag_targets[e]]);
+                }
+            }
         }
     }
+
+    ix.version = version;
+    ix.built = true;
 }
-// ========================================
-// Helper Methods
-// ========================================
+
+// Precondition: component holds count components of the current graph
+// Postcondition: returns the sorted successors of each component in the
+//                condensation DAG, without self loops or duplicate edges
 
 template <typename D, typename K>
-void Graph<D, K>::reset_bfs_state()
+vector<vector<int>> Graph<D, K>::component_edges(const vector<int> &component, int count) const
 {
-    for (auto it = vertices.begin(); it != vertices.end(); it++)
-    {
-        Vertex<D, K> *v = it->second; 
-        v->visited = false; 
-        v->distance = -1;  
-        v->pi = K();
+    vector<vector<int>> dag(count);
+    for (size_t u = 0; u < id_to_vertex.size(); u++) {
+        for (size_t e = offsets[u]; e < ends[u]; e++) {
+            int cu = component[u];
+            int cv = component[neighbors[e]];
+            if (cu != cv) dag[cu].push_back(cv);
+        }
     }
+    for (vector<int> &successors : dag) {
+        sort(successors.begin(), successors.end());
+        successors.erase(unique(successors.begin(), successors.end()), successors.end());
+    }
+    return dag;
 }
 
+// Precondition: none
+// Postcondition: returns the components of the current graph, recomputing
+//                them only if the graph version changed since the last call
+
 template <typename D, typename K>
-void Graph<D, K>::dfs(K source)
+const SccResult &Graph<D, K>::scc()
 {
-    reset_dfs_state();
-    int time = 0;
+    decompress();
+    lock_guard<mutex> lock(cache_lock);
+    if (!scc_cache_valid || scc_cache_version != version) {
+        scc_cache.count = strongly_connected(scc_cache.component);
+        scc_cache_valid = true;
+        scc_cache_version = version;
+    }
+    return scc_cache;
+}
 
-    // Visit ALL vertices, creating a forest if needed
-    for (auto& pair : vertices) {
-        K vertex_key = pair.first;
-        Vertex<D, K>* vertex = pair.second;
-        
-        if (!vertex->visited) {
-            dfs_visit(vertex_key, time);  // Start new tree
-        }
+// Precondition: none
+// Postcondition: returns true if u and v reach each other (false if a key is missing)
+
+template <typename D, typename K>
+bool Graph<D, K>::same_component(K u, K v)
+{
+    int u_id = id_of(u);
+    int v_id = id_of(v);
+    if (u_id < 0 || v_id < 0) return false;
+
+    const SccResult &r = scc();
+    return r.component[u_id] == r.component[v_id];
+}
+
+// Precondition: none
+// Postcondition: returns a new graph with one vertex per component
+
+template <typename D, typename K>
+Graph<vector<K>, int> *Graph<D, K>::condensation()
+{
+    const SccResult &r = scc();
+    vector<int> keys(r.count);
+    vector<vector<K>> members(r.count);
+    for (int c = 0; c < r.count; c++) {
+        keys[c] = c;
     }
-}   
+    for_each_id([&](int id) { members[r.component[id]].push_back(key_of(id)); });
 
+    return new Graph<vector<K>, int>(keys, members, component_edges(r.component, r.count));
+}
 
 template <typename D, typename K>
-void Graph<D, K>::reset_dfs_state()
+bool Graph<D, K>::has_reachability_index() const
 {
-    for (auto& pair : vertices)
-    {
-        pair.second->visited = false;
-        pair.second->pi = K();
-        pair.second->discovery_time = -1;
-        pair.second->finish_time = -1;
+    return reach_index.built && reach_index.version == version;
+}
+
+template <typename D, typename K>
+size_t Graph<D, K>::reachability_index_bytes() const
+{
+    const ReachabilityIndex &ix = reach_index;
+    size_t bytes = sizeof(ix);
+    bytes += ix.component.capacity() * sizeof(int);
+    bytes += ix.dag_offsets.capacity() * sizeof(size_t);
+    bytes += ix.dag_targets.capacity() * sizeof(int);
+    bytes += ix.pre.capacity() * sizeof(int);
+    for (int l = 0; l < ReachabilityIndex::LABELS; l++) {
+        bytes += (ix.post[l].capacity() + ix.low[l].capacity()) * sizeof(int);
     }
+    return bytes;
 }
 
 template <typename D, typename K>
-void Graph<D, K>::dfs_visit(K u_key, int& time)
+unsigned long Graph<D, K>::get_version() const
 {
-    Vertex<D, K>* u = get(u_key);
-    if (u == nullptr) return;
-    
-    u->visited = true;
+    return version;
+}
 
-    time++;
-    u->discovery_time = time;
-    
-    for (K v_key : u->adj) {
-        Vertex<D, K>* v = get(v_key);
-        if (v == nullptr) continue;
-        
-        if (!v->visited) {
-            v->pi = u_key;
-            dfs_visit(v_key, time);
-        }
-    }
-    
-    time++;
-    u->finish_time = time;
+template <typename D, typename K>
+TraversalStats Graph<D, K>::last_stats()
+{
+#ifdef GRAPH_STATS
+    return traversal_stats();
+#else
+    return TraversalStats();
+#endif
 }
 
 template <typename D, typename K>
-K Graph<D, K>::find_source()
+void Graph<D, K>::set_stats_hook(function<void(const TraversalStats &)> hook)
 {
-    for (auto& pair : vertices) {
-        if (pair.second->distance == 0) {
-            return pair.first;
-        }
+    stats_hook = move(hook);
+}
+
+template <typename D, typename K>
+MemoryStats Graph<D, K>::memory_usage() const
+{
+    MemoryStats m;
+    m.vertices = vertices.size();
+    for (auto &pair : vertices) {
+        const Vertex<D, K> *v = pair.second;
+        m.vertex_bytes += sizeof(Vertex<D, K>) + v->adj.capacity() * sizeof(K) + v->weights.capacity() * sizeof(double);
     }
-    return K();  // Default constructed key
-}
\ No newline at end of file
+    m.csr_bytes = offsets.owned_bytes() + ends.owned_bytes() + neighbors.owned_bytes();
+    m.csr_bytes += rev_offsets.owned_bytes() + rev_ends.owned_bytes() + rev_neighbors.owned_bytes();
+    m.csr_bytes += (limits.capacity() + rev_limits.capacity()) * sizeof(size_t);
+    m.csr_bytes += id_to_vertex.capacity() * sizeof(Vertex<D, K> *) + key_index.bytes();
+    m.csr_bytes += dense_ids.capacity() * sizeof(int) + weight_cache.capacity() * sizeof(double);
+    m.csr_bytes += packed_out.memory_bytes() + packed_in.memory_bytes();
+    if (reach_index.built) m.index_bytes = reachability_index_bytes();
+    return m;
+}
+
+// Precondition: has_reachability_index()
+// Postcondition: returns true if vertex id v is reachable from vertex id u
+
+template <typename D, typename K>
+bool Graph<D, K>::index_reachable(int u, int v) const
+{
+    const ReachabilityIndex &ix = reach_index;
+    int cu = ix.component[u];
+    int cv = ix.component[v];
+    if (cu == cv) return true;
+
+    // cv must lie inside every [low, post] interval of cu
+    auto may_reach = [&](int x) {
+        for (int l = 0; l < ReachabilityIndex::LABELS; l++) {
+            if (ix.low[l][x] > ix.low[l][cv] || ix.post[l][x] < ix.post[l][cv]) return false;
+        }
+        return true;
+    };
+    if (!may_reach(cu)) return false;
+
+    // Descendant in the spanning forest of the first pass
+    if (ix.pre[cu] <= ix.pre[cv] && ix.post[0][cv] <= ix.post[0][cu]) return true;
+
+    // Fallback: DFS over the DAG, pruned to components whose labels allow cv
+    static thread_local EpochStamps seen;
+    static thread_local vector<int> stack;
+    seen.next(ix.components);
+    stack.clear();
+    stack.push_back(cu);
+    seen.mark(cu);
+    while (!stack.empty()) {
+        int x = stack.back();
+        stack.pop_back();
+        for (size_t e = ix.dag_offsets[x]; e < ix.dag_offsets[x + 1]; e++) {
+            int y = ix.dag_targets[e];
+            if (y == cv) return true;
+            if (seen.current(y) || !may_reach(y)) continue;
+            seen.mark(y);
+            stack.push_back(y);
+        }
+    }
+    return false;
+}
+
+// Precondition: none
+// Postcondition: fn(lo, hi) has run over ranges covering [0, n), split across
+//                the thread pool when the graph is large enough
+
+template <typename D, typename K>
+void Graph<D, K>::for_ranges(size_t n, const function<void(size_t, size_t)> &fn) const
+{
+    unsigned workers = get_threads();
+    if (workers <= 1 || n < parallel_min_vertices) {
+        fn(0, n);
+        return;
+    }
+
+    size_t chunk = (n + workers - 1) / workers;
+    ThreadPool::shared().run(workers, [&](size_t t) {
+        size_t lo = min(n, t * chunk);
+        fn(lo, min(n, lo + chunk));
+    });
+}
+
+template <typename D, typename K>
+void Graph<D, K>::set_threads(unsigned n, size_t min_vertices)
+{
+    threads = n;
+    parallel_min_vertices = min_vertices;
+}
+
+template <typename D, typename K>
+unsigned Graph<D, K>::get_threads() const
+{
+    if (threads > 0) return threads;
+    return max(1u, thread::hardware_concurrency());
+}
+
+template <typename D, typename K>
+BfsResult Graph<D, K>::bfs_hybrid_result(K s) const
+{
+    BfsResult r;
+    bfs_hybrid_result(s, r);
+    return r;
+}
+
+// Precondition: none
+// Postcondition: r holds the same distances as bfs_result(s, r) and a valid
+//                BFS parent for every reached vertex except s
+
+template <typename D, typename K>
+void Graph<D, K>::bfs_hybrid_result(K s, BfsResult &r) const
+{
+    GRAPH_STATS_CALL("bfs_hybrid_result");
+    if (compressed) {
+        bfs_result(s, r); // Bottom-up steps need random access to the reverse rows
+        return;
+    }
+    size_t n = id_to_vertex.size();
+    {
+        GRAPH_STATS_PHASE(reset);
+        r.begin(n);
+    }
+
+    int src = id_of(s);
+    if (src < 0) return;
+
+    GRAPH_STATS_PHASE(search);
+    r.source = src;
+    r.visit(src, 0, -1);
+    GRAPH_STATS_ADD(vertices_visited, 1);
+
+    size_t unexplored_edges = edge_count - (ends[src] - offsets[src]);
+    size_t frontier_edges = ends[src] - offsets[src];
+    bool bottom_up = false;
+
+    // The current frontier is always r.order[level_begin..level_end)
+    size_t level_begin = 0;
+    for (int level = 0; level_begin < r.order.size(); level++)
+    {
+        size_t level_end = r.order.size();
+        size_t frontier_size = level_end - level_begin;
+        GRAPH_STATS_MAX(queue_peak, frontier_size);
+
+        if (!bottom_up && frontier_edges > unexplored_edges / HYBRID_ALPHA) {
+            bottom_up = true;
+        } else if (bottom_up && frontier_size < n / HYBRID_BETA) {
+            bottom_up = false;
+        }
+
+        if (bottom_up) {
+            // Every unvisited vertex looks for a parent on the current level
+            for (size_t v = 0; v < n; v++) {
+                if (r.reached(v)) continue;
+
+                for (size_t e = rev_offsets[v]; e < rev_ends[v]; e++) {
+                    int u = rev_neighbors[e];
+                    GRAPH_STATS_ADD(edges_scanned, 1);
+                    if (r.distance(u) == level) {
+                        r.visit(v, level + 1, u);
+                        GRAPH_STATS_ADD(vertices_visited, 1);
+                        break;
+                    }
+                }
+            }
+        } else {
+            for (size_t i = level_begin; i < level_end; i++) {
+                int u = r.order[i];
+                for (size_t e = offsets[u]; e < ends[u]; e++) {
+                    int v = neighbors[e];
+                    GRAPH_STATS_ADD(edges_scanned, 1);
+                    if (!r.reached(v)) {
+                        r.visit(v, level + 1, u);
+                        GRAPH_STATS_ADD(vertices_visited, 1);
+                    }
+                }
+            }
+        }
+
+        // Edge counts of the next frontier drive the next direction choice
+        frontier_edges = 0;
+        for (size_t i = level_end; i < r.order.size(); i++) {
+            frontier_edges += ends[r.order[i]] - offsets[r.order[i]];
+        }
+        unexplored_edges -= min(unexplored_edges, frontier_edges);
+        level_begin = level_end;
+    }
+}
+
+/*
+G.print_path(u, v) should print the shortest path from the vertex corresponding to the key u to the vertex corresponding to the key v in the graph G.
+If there is no path from u to v, the function should not print anything.
+*/
+
+// Precondition: keys u and v exist in graph G
+// Postcondition: prints shortest path from u to v if exists
+
+template <typename D, typename K>
+void Graph<D, K>::print_path(K u, K v)
+{
+    GRAPH_STATS_CALL("print_path");
+    int target = id_of(v); // Get target vertex
+
+    // BFS from u to set up parent values, stopping once v is found
+    static thread_local BfsResult r;
+    bfs_from(id_of(u), target, r);
+    record_bfs(r);
+
+    if (target < 0 || r.distance(target) == -1) {
+        return;
+    }
+
+    vector<K> path; // To store the path
+
+    // Walk parents from the target back to the source (whose parent is -1)
+    for (int current = target; current != -1; current = r.parent(current)) {
+        path.push_back(key_of(current));
+    }
+
+    for (int i = path.size() - 1; i >= 0; i--) {
+        cout << path[i];
+        if (i > 0) cout << " -> ";
+    }
+}
+
+/*
+G.edge_class(u, v) should classify the edge (u, v) in the graph G as one of the following types: "tree edge", "back edge", "forward edge",
+"cross edge", or "no edge".
+*/
+// Precondition: keys u and v exist in graph G
+// Postcondition: returns string representing edge classification
+
+template <typename D, typename K>
+string Graph<D, K>::edge_class(K u, K v)
+{
+    GRAPH_STATS_CALL("edge_class");
+    int u_id = id_of(u);
+    if (u_id < 0) return "no edge";
+
+    int v_id = id_of(v);
+    if (v_id < 0) return "no edge";
+
+    // Check if edge exists
+    if (!has_edge_id(u_id, v_id)) return "no edge";
+
+    // The DFS forest visits every vertex in key order whatever the last BFS
+    // was, so it is only recomputed after a change to the graph
+    return classify(u_id, v_id, cached_dfs());
+}
+
+// Precondition: forest is the result of dfs_result() on the current graph
+// Postcondition: returns the type of edge u -> v in forest, or "no edge"
+
+template <typename D, typename K>
+string Graph<D, K>::edge_class(K u, K v, const DfsResult &forest) const
+{
+    GRAPH_STATS_CALL("edge_class");
+    int u_id = id_of(u);
+    int v_id = id_of(v);
+    if (u_id < 0 || v_id < 0 || !has_edge_id(u_id, v_id)) return "no edge";
+    return classify(u_id, v_id, forest);
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::has_edge_id(int u, int v) const
+{
+    return with_rows([&](const auto &out, const auto &) {
+        for (int x : out.row(u)) {
+            if (x == v) return true;
+        }
+        return false;
+    });
+}
+
+// Precondition: none
+// Postcondition: returns one entry per edge, grouped by source vertex in key order
+
+template <typename D, typename K>
+vector<ClassifiedEdge<K>> Graph<D, K>::classify_all_edges()
+{
+    GRAPH_STATS_CALL("classify_all_edges");
+    const DfsResult &r = cached_dfs();
+
+    vector<ClassifiedEdge<K>> edges;
+    edges.reserve(edge_count);
+    with_rows([&](const auto &out, const auto &) {
+        for_each_id([&](int u) {
+            for (int v : out.row(u)) {
+                edges.push_back({key_of(u), key_of(v), classify(u, v, r)});
+            }
+        });
+    });
+    return edges;
+}
+
+// Precondition: none
+// Postcondition: returns the DFS forest, recomputing it only if the graph
+//                version changed since the last call
+
+template <typename D, typename K>
+const DfsResult &Graph<D, K>::cached_dfs()
+{
+    lock_guard<mutex> lock(cache_lock);
+    if (!dfs_cache_valid || dfs_cache_version != version) {
+        dfs_result(dfs_cache);
+        dfs_cache_valid = true;
+        dfs_cache_version = version;
+    }
+    return dfs_cache;
+}
+
+// Precondition: (u, v) is an edge and r is a DFS forest of the graph
+// Postcondition: returns the type of the edge in r
+
+template <typename D, typename K>
+string Graph<D, K>::classify(int u_id, int v_id, const DfsResult &r) const
+{
+    // Tree edge: v.π = u
+    if (r.parent(v_id) == u_id) {
+        return "tree edge";
+    }
+
+    // Back edge: edge to ancestor (v's interval contains u's interval)
+    if (r.discovery_time(v_id) < r.discovery_time(u_id) &&
+        r.finish_time(u_id) < r.finish_time(v_id)) {
+        return "back edge";
+    }
+
+    // Forward edge: edge to descendant (u's interval contains v's interval)
+    if (r.discovery_time(u_id) < r.discovery_time(v_id) &&
+        r.finish_time(v_id) < r.finish_time(u_id)) {
+        return "forward edge";
+    }
+
+    // Cross edge: everything else
+    return "cross edge";
+}
+
+
+/*
+bfs_tree(s): G.bfs_tree(s) should perform a breadth-first search (BFS) traversal of the graph G starting from the source vertex corresponding to the key s and print the vertices level by level.
+*/
+// Precondition: key s exists in graph G
+// Postcondition: prints vertices level by level from source s
+
+template <typename D, typename K>
+void Graph<D, K>::bfs_tree(K s)
+{
+    GRAPH_STATS_CALL("bfs_tree");
+    static thread_local BfsResult r;
+    bfs_result(s, r);
+    record_bfs(r);
+    if (r.source < 0) return;
+
+    // Discovery order is sorted by distance, so each level is a contiguous run
+    for (size_t i = 0; i < r.order.size(); i++) {
+        if (i > 0) {
+            bool new_level = r.distance(r.order[i]) != r.distance(r.order[i - 1]);
+            cout << (new_level ? "\n" : " ");
+        }
+        cout << key_of(r.order[i]);
+    }
+}
+// ========================================
+// Helper Methods
+// ========================================
+
+// Resets only the vertices written by the previous bfs() (or all of them after
+// dfs()/rebuild()), so bfs() costs time proportional to what it explores
+template <typename D, typename K>
+void Graph<D, K>::reset_bfs_state()
+{
+    GRAPH_STATS_PHASE(reset);
+    GRAPH_STATS_ADD(vertices_reset, bfs_touched.size());
+    for (int id : bfs_touched)
+    {
+        Vertex<D, K> *v = id_to_vertex[id];
+        if (v == nullptr) continue; // Snapshot vertex never materialized
+        v->visited = false;
+        v->distance = -1;
+        v->pi = K();
+    }
+    bfs_touched.clear();
+}
+
+template <typename D, typename K>
+void Graph<D, K>::dfs(K source)
+{
+    GRAPH_STATS_CALL("dfs");
+    static thread_local DfsResult r;
+    dfs_result(r);
+
+    // Copy the result into the vertices (compatibility mode); every vertex is
+    // written, so no reset is needed first
+    for_each_id([&](int id) {
+        Vertex<D, K>* v = vertex_at(id);
+        v->visited = true;
+        v->pi = r.parent(id) < 0 ? K() : key_of(r.parent(id));
+        v->discovery_time = r.discovery_time(id);
+        v->finish_time = r.finish_time(id);
+    });
+    mark_all_bfs_touched();
+}
+
+// Precondition: none
+// Postcondition: returns the DFS forest over all vertices, roots tried in key order;
+//                the graph is not modified
+
+template <typename D, typename K>
+DfsResult Graph<D, K>::dfs_result() const
+{
+    DfsResult r;
+    dfs_result(r);
+    return r;
+}
+
+template <typename D, typename K>
+void Graph<D, K>::dfs_result(DfsResult& r) const
+{
+    GRAPH_STATS_CALL("dfs_result");
+    {
+        GRAPH_STATS_PHASE(reset);
+        r.begin(id_to_vertex.size());
+    }
+    GRAPH_STATS_PHASE(search);
+    int time = 0;
+
+    // Visit ALL vertices in key order, creating a forest if needed
+    for_each_id([&](int id) {
+        if (!r.discovered(id)) {
+            dfs_visit_id(id, time, r);  // Start new tree
+        }
+    });
+}
+
+// Precondition: 0 <= id < number of ids
+// Postcondition: returns false if id is the tombstone of a removed vertex
+
+template <typename D, typename K>
+bool Graph<D, K>::is_live(int id) const
+{
+    return snapshot || id_to_vertex[id] != nullptr;
+}
+
+// Precondition: none
+// Postcondition: fn(id) has been called for every live vertex in key order
+
+template <typename D, typename K>
+template <typename F>
+void Graph<D, K>::for_each_id(F fn) const
+{
+    if (ids_in_key_order) {
+        for (size_t id = 0; id < id_to_vertex.size(); id++) {
+            if (is_live(id)) fn(id);
+        }
+    } else if (snapshot) {
+        // Most vertices are not materialized; the file lists the ids by key
+        const int *order = reinterpret_cast<const int *>(snapshot_section(SnapshotHeader::KEY_ORDER));
+        for (size_t i = 0; i < id_to_vertex.size(); i++) fn(order[i]);
+    } else {
+        for (auto& pair : vertices) fn(pair.second->id);
+    }
+}
+
+
+template <typename D, typename K>
+void Graph<D, K>::reset_dfs_state()
+{
+    GRAPH_STATS_PHASE(reset);
+    GRAPH_STATS_ADD(vertices_reset, vertices.size());
+    for (auto& pair : vertices)
+    {
+        pair.second->visited = false;
+        pair.second->pi = K();
+        pair.second->discovery_time = -1;
+        pair.second->finish_time = -1;
+    }
+}
+
+// Compatibility entry point: visits from u_key using the DFS fields stored in
+// the vertices. Prefer dfs_result() for new code.
+template <typename D, typename K>
+void Graph<D, K>::dfs_visit(K u_key, int& time)
+{
+    GRAPH_STATS_CALL("dfs_visit");
+    int u_id = id_of(u_key);
+    if (u_id < 0) return;
+
+    if (vertex_at(u_id)->visited) return;
+
+    // Load the vertices already visited into a result object
+    static thread_local DfsResult r;
+    {
+        GRAPH_STATS_PHASE(reset);
+        GRAPH_STATS_ADD(vertices_reset, id_to_vertex.size());
+        r.begin(id_to_vertex.size());
+        for (size_t id = 0; id < id_to_vertex.size(); id++) {
+            Vertex<D, K>* v = id_to_vertex[id];
+            if (v != nullptr && v->visited) {
+                r.discover(id, -1, v->discovery_time);
+            }
+        }
+    }
+
+    int start = time;
+    {
+        GRAPH_STATS_PHASE(search);
+        dfs_visit_id(u_id, time, r);
+    }
+
+    // Store back every vertex discovered by this visit
+    for (size_t id = 0; id < id_to_vertex.size(); id++) {
+        if (r.discovered(id) && r.discovery_time(id) > start) {
+            Vertex<D, K>* v = vertex_at(id);
+            v->visited = true;
+            if (r.parent(id) >= 0) v->pi = key_of(r.parent(id));
+            v->discovery_time = r.discovery_time(id);
+            v->finish_time = r.finish_time(id);
+        }
+    }
+    mark_all_bfs_touched();
+}
+
+// Iterative DFS from root: each frame is (vertex id, next edge to scan), so the
+// search depth is bounded by memory rather than the call stack. Produces the same
+// times and parents as visiting neighbors recursively in adjacency order.
+template <typename D, typename K>
+void Graph<D, K>::dfs_visit_id(int root, int& time, DfsResult& r) const
+{
+    with_rows([&](const auto &out, const auto &) { dfs_visit_rows(out, root, time, r); });
+}
+
+template <typename D, typename K>
+template <typename Rows>
+void Graph<D, K>::dfs_visit_rows(const Rows &out, int root, int& time, DfsResult& r) const
+{
+    time++;
+    if (!r.discovered(root)) r.discover(root, -1, time);
+    r.d_time[root] = time;
+    GRAPH_STATS_ADD(vertices_visited, 1);
+
+    r.frames.clear();
+    r.frames.push_back({root, out.start(root)});
+
+    while (!r.frames.empty()) {
+        int u = r.frames.back().first;
+        RowCursor &e = r.frames.back().second;
+
+        if (!out.done(u, e)) {
+            int v = out.next(e);
+            GRAPH_STATS_ADD(edges_scanned, 1);
+
+            if (!r.discovered(v)) {
+                time++;
+                r.discover(v, u, time);
+                r.frames.push_back({v, out.start(v)}); // Invalidates e
+                GRAPH_STATS_ADD(vertices_visited, 1);
+                GRAPH_STATS_MAX(queue_peak, r.frames.size());
+            }
+            continue;
+        }
+
+        time++;
+        r.f_time[u] = time;
+        r.frames.pop_back();
+    }
+}
+
+template <typename D, typename K>
+K Graph<D, K>::find_source()
+{
+    // Usually the source of the last bfs(), unless the vertices were edited since
+    if (bfs_source >= 0 && bfs_source < (int)id_to_vertex.size() &&
+        id_to_vertex[bfs_source] != nullptr && id_to_vertex[bfs_source]->distance == 0) {
+        return key_of(bfs_source);
+    }
+    for (auto& pair : vertices) {
+        if (pair.second->distance == 0) {
+            return pair.first;
+        }
+    }
+    return K();  // Default constructed key
+}
+
+// Precondition: none
+// Postcondition: every vertex has a dense id (in key order) and offsets/neighbors
+//                hold the adjacency of all vertices; keys in adj that are not
+//                vertices of the graph are dropped
+
+template <typename D, typename K>
+void Graph<D, K>::rebuild()
+{
+    // A snapshot graph becomes an ordinary in-memory graph
+    for (size_t id = 0; snapshot && id < id_to_vertex.size(); id++) {
+        vertex_at(id);
+    }
+
+    id_to_vertex.clear();
+    id_to_vertex.reserve(vertices.size());
+    for (auto& pair : vertices) {
+        pair.second->id = id_to_vertex.size();
+        id_to_vertex.push_back(pair.second);
+    }
+    // Ids may have changed, so the next bfs() resets every vertex
+    mark_all_bfs_touched();
+    version++;
+    index_keys();
+
+    size_t n = id_to_vertex.size();
+
+    // Resolve every adj key once (on several threads for large graphs), then
+    // drop the edges to non-existent vertices
+    vector<size_t> adj_begin(n + 1, 0);
+    for (size_t id = 0; id < n; id++) {
+        adj_begin[id + 1] = adj_begin[id] + id_to_vertex[id]->adj.size();
+    }
+    vector<int> resolved(adj_begin[n]);
+    vector<size_t> off(n + 1, 0);
+    for_ranges(n, [&](size_t lo, size_t hi) {
+        for (size_t id = lo; id < hi; id++) {
+            size_t pos = adj_begin[id];
+            size_t count = 0;
+            for (const K& v_key : id_to_vertex[id]->adj) {
+                int v = index_find(v_key);
+                resolved[pos++] = v;
+                if (v >= 0) count++;
+            }
+            off[id + 1] = count;
+        }
+    });
+    dangling.clear();
+    for (size_t id = 0; id < n; id++) {
+        const Vertex<D, K> *x = id_to_vertex[id];
+        if (off[id + 1] < x->adj.size()) {
+            for (size_t i = 0; i < x->adj.size(); i++) {
+                if (resolved[adj_begin[id] + i] >= 0) continue;
+                vector<K> &sources = dangling[x->adj[i]];
+                if (sources.empty() || !(sources.back() == x->key)) sources.push_back(x->key);
+            }
+        }
+        off[id + 1] += off[id];
+    }
+
+    vector<int> nbr(off[n]);
+    for_ranges(n, [&](size_t lo, size_t hi) {
+        for (size_t id = lo; id < hi; id++) {
+            copy_if(resolved.begin() + adj_begin[id], resolved.begin() + adj_begin[id + 1],
+                    nbr.begin() + off[id], [](int v) { return v >= 0; });
+        }
+    });
+
+    set_csr(move(off), move(nbr));
+    ids_in_key_order = true;
+    tombstones = 0;
+
+    snapshot_header = nullptr;
+    snapshot.reset();
+    if (id_order != VertexOrder::KEYS) renumber(ordered_ids());
+}
+
+// Precondition: off/nbr are packed CSR arrays over id_to_vertex
+// Postcondition: the forward arrays hold off/nbr, the reverse arrays are
+//                rebuilt from them and every row is packed
+
+template <typename D, typename K>
+void Graph<D, K>::set_csr(vector<size_t> &&off, vector<int> &&nbr)
+{
+    size_t n = off.size() - 1;
+
+    // Reverse adjacency by counting sort on edge targets
+    vector<size_t> rev_off(n + 1, 0);
+    for (int v : nbr) {
+        rev_off[v + 1]++;
+    }
+    for (size_t id = 0; id < n; id++) {
+        rev_off[id + 1] += rev_off[id];
+    }
+    vector<int> rev_nbr(nbr.size());
+    vector<size_t> fill_pos(rev_off.begin(), rev_off.end() - 1);
+    for (size_t u = 0; u < n; u++) {
+        for (size_t e = off[u]; e < off[u + 1]; e++) {
+            rev_nbr[fill_pos[nbr[e]]++] = u;
+        }
+    }
+
+    edge_count = nbr.size();
+    offsets.set(move(off));
+    neighbors.set(move(nbr));
+    rev_offsets.set(move(rev_off));
+    rev_neighbors.set(move(rev_nbr));
+
+    ends.view(offsets.data() + 1, n);
+    rev_ends.view(rev_offsets.data() + 1, n);
+    vector<size_t>().swap(limits);
+    vector<size_t>().swap(rev_limits);
+    garbage = 0;
+    packed = true;
+    compressed = false;
+    packed_out.clear();
+    packed_in.clear();
+}
+
+// Precondition: none
+// Postcondition: returns the dense id of key, or -1 if key is not in the graph
+
+template <typename D, typename K>
+int Graph<D, K>::id_of(K key) const
+{
+    GRAPH_STATS_ADD(lookups, 1);
+    GRAPH_STATS_PHASE(lookup);
+    if (snapshot) return snapshot_find(key);
+    return index_find(key);
+}
+
+template <typename D, typename K>
+int Graph<D, K>::index_find(const K &key) const
+{
+    if constexpr (DENSE_KEY_TYPE) {
+        if (dense_active) {
+            if (key < dense_lo || dense_offset(key, dense_lo) >= dense_ids.size()) return -1;
+            return dense_ids[dense_offset(key, dense_lo)];
+        }
+    }
+    return key_index.find(key, [this](int id) -> const K & { return id_to_vertex[id]->key; });
+}
+
+template <typename D, typename K>
+void Graph<D, K>::set_dense_keys(bool on) requires integral<K> && (!same_as<K, bool>)
+{
+    dense_keys = on;
+    index_dense_keys();
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::has_dense_keys() const
+{
+    return dense_active;
+}
+
+// Precondition: every vertex in id_to_vertex is materialized
+// Postcondition: dense_active is set if the policy is on and the keys are
+//                dense enough, with dense_ids covering every key
+
+template <typename D, typename K>
+void Graph<D, K>::index_dense_keys()
+{
+    dense_active = false;
+    vector<int>().swap(dense_ids);
+    if constexpr (DENSE_KEY_TYPE) {
+        if (!dense_keys || snapshot || vertices.empty()) return;
+
+        // Keys in the map are sorted, so the span is last - first
+        K lo = vertices.begin()->first;
+        size_t span = dense_offset(vertices.rbegin()->first, lo);
+        if (span >= DENSE_KEY_SPREAD * vertices.size()) return;
+
+        dense_lo = lo;
+        dense_ids.assign(span + 1, -1);
+        for (size_t id = 0; id < id_to_vertex.size(); id++) {
+            if (id_to_vertex[id] != nullptr) dense_ids[dense_offset(id_to_vertex[id]->key, lo)] = id;
+        }
+        dense_active = true;
+    }
+}
+
+// Precondition: key is a new vertex key with the given id
+// Postcondition: the dense table covers key, or dense_active is cleared if
+//                covering it would make the table too sparse
+
+template <typename D, typename K>
+void Graph<D, K>::dense_insert(const K &key, int id)
+{
+    if constexpr (DENSE_KEY_TYPE) {
+        if (!dense_active) return;
+
+        if (key < dense_lo) {
+            size_t grow = dense_offset(dense_lo, key);
+            if (grow + dense_ids.size() > DENSE_KEY_SPREAD * vertices.size()) {
+                dense_active = false;
+                vector<int>().swap(dense_ids);
+                return;
+            }
+            dense_ids.insert(dense_ids.begin(), grow, -1);
+            dense_lo = key;
+        }
+        size_t offset = dense_offset(key, dense_lo);
+        if (offset >= dense_ids.size()) {
+            if (offset >= DENSE_KEY_SPREAD * vertices.size()) {
+                dense_active = false;
+                vector<int>().swap(dense_ids);
+                return;
+            }
+            dense_ids.resize(offset + 1, -1);
+        }
+        dense_ids[offset] = id;
+    }
+}
+
+// Precondition: key >= lo
+// Postcondition: returns key - lo without overflowing K
+
+template <typename D, typename K>
+size_t Graph<D, K>::dense_offset(K key, K lo)
+{
+    if constexpr (DENSE_KEY_TYPE) {
+        using U = make_unsigned_t<K>;
+        return size_t(U(key) - U(lo));
+    } else {
+        return 0;
+    }
+}
+
+template <typename D, typename K>
+void Graph<D, K>::index_keys()
+{
+    key_index.clear(id_to_vertex.size());
+    for (size_t id = 0; id < id_to_vertex.size(); id++) {
+        if (id_to_vertex[id] != nullptr) key_index.insert(id_to_vertex[id]->key, id);
+    }
+    index_dense_keys();
+}
+
+// Precondition: 0 <= id < number of vertices
+// Postcondition: returns the key of the vertex with dense id
+
+template <typename D, typename K>
+K Graph<D, K>::key_of(int id) const
+{
+    if (snapshot) return snapshot_key(id);
+    return id_to_vertex[id]->key;
+}
+
+// ========================================
+// Weighted Shortest Paths
+// ========================================
+
+// Precondition: weight >= 0
+// Postcondition: the first edge u -> v weighs weight; returns false if there
+//                is no such edge
+
+template <typename D, typename K>
+bool Graph<D, K>::set_weight(K u, K v, double weight)
+{
+    if (!(weight >= 0)) return false; // Also rejects NaN
+
+    decompress();
+    int a = id_of(u);
+    int b = id_of(v);
+    if (a < 0 || b < 0) return false;
+    if (find(neighbors.begin() + offsets[a], neighbors.begin() + ends[a], b) == neighbors.begin() + ends[a]) {
+        return false;
+    }
+    if (snapshot) unpack(); // Weights live in the vertices
+
+    Vertex<D, K> *x = id_to_vertex[a];
+    size_t i = find(x->adj.begin(), x->adj.end(), v) - x->adj.begin();
+    if (x->weights.size() <= i) x->weights.resize(i + 1, 1);
+    x->weights[i] = weight;
+    weight_cache_valid = false;
+    return true;
+}
+
+// Precondition: none
+// Postcondition: returns the weight of edge u -> v, or infinity if there is none
+
+template <typename D, typename K>
+double Graph<D, K>::weight(K u, K v)
+{
+    int a = id_of(u);
+    int b = id_of(v);
+    if (a < 0 || b < 0) return numeric_limits<double>::infinity();
+
+    const vector<double> &w = csr_weights();
+    for (size_t e = offsets[a]; e < ends[a]; e++) {
+        if (neighbors[e] == b) return w.empty() ? 1 : w[e];
+    }
+    return numeric_limits<double>::infinity();
+}
+
+// Precondition: none
+// Postcondition: returns the weight of every slot of neighbors, or an empty
+//                vector if every edge weighs 1; rebuilt only after a change
+
+template <typename D, typename K>
+const vector<double> &Graph<D, K>::csr_weights()
+{
+    decompress();
+    lock_guard<mutex> lock(cache_lock);
+    if (weight_cache_valid && weight_cache_version == version) return weight_cache;
+    weight_cache_valid = true;
+    weight_cache_version = version;
+    weight_cache.clear();
+    if (snapshot) return weight_cache; // Snapshots are unweighted
+
+    bool weighted = false;
+    for_each_id([&](int id) { weighted = weighted || !id_to_vertex[id]->weights.empty(); });
+    if (!weighted) return weight_cache;
+
+    // Row u holds the edges of adj whose keys are vertices, skipping the
+    // others, so slots and adj entries are paired by target: the k-th slot to
+    // v gets the k-th adj entry for v
+    weight_cache.assign(neighbors.size(), 1);
+    vector<pair<int, size_t>> slots, entries;
+    for_each_id([&](int u) {
+        const Vertex<D, K> *x = id_to_vertex[u];
+        if (x->weights.empty()) return;
+        slots.clear();
+        entries.clear();
+        for (size_t e = offsets[u]; e < ends[u]; e++) {
+            slots.push_back({neighbors[e], e});
+        }
+        for (size_t i = 0; i < x->adj.size(); i++) {
+            int v = index_find(x->adj[i]);
+            if (v >= 0) entries.push_back({v, i});
+        }
+        sort(slots.begin(), slots.end());
+        sort(entries.begin(), entries.end());
+        for (size_t k = 0; k < slots.size() && k < entries.size(); k++) {
+            size_t i = entries[k].second;
+            if (i < x->weights.size()) weight_cache[slots[k].second] = x->weights[i];
+        }
+    });
+    return weight_cache;
+}
+
+// Dijkstra's algorithm with a 4-ary heap and lazy deletion: a vertex is pushed
+// once per improvement, and entries older than its distance are skipped.
+// Precondition: source is a vertex id or -1; target is a vertex id or -1
+// Postcondition: r holds shortest distances from source. With a target the
+//                search stops once the target is settled; only the target
+//                and the vertices in r.order are then final.
+
+template <typename D, typename K>
+void Graph<D, K>::dijkstra(int source, int target, ShortestPaths &r)
+{
+    {
+        GRAPH_STATS_PHASE(reset);
+        r.begin(id_to_vertex.size());
+    }
+    if (source < 0) return;
+
+    const vector<double> &w = csr_weights();
+    GRAPH_STATS_PHASE(search);
+    static thread_local DaryHeap<4> heap;
+    heap.clear();
+    r.source = source;
+    r.set(source, 0, -1);
+    heap.push(0, source);
+
+    while (!heap.empty()) {
+        auto [d, u] = heap.top();
+        heap.pop();
+        if (d > r.dist[u]) continue; // Stale entry
+
+        r.order.push_back(u);
+        GRAPH_STATS_ADD(vertices_visited, 1);
+        if (u == target) return;
+
+        for (size_t e = offsets[u]; e < ends[u]; e++) {
+            int v = neighbors[e];
+            double nd = d + (w.empty() ? 1 : w[e]);
+            GRAPH_STATS_ADD(edges_scanned, 1);
+            if (!r.reached(v) || nd < r.dist[v]) {
+                r.set(v, nd, u);
+                heap.push(nd, v);
+                GRAPH_STATS_MAX(queue_peak, heap.size());
+            }
+        }
+    }
+}
+
+// Precondition: none
+// Postcondition: returns the distance and a shortest-path parent of every
+//                vertex reachable from s
+
+template <typename D, typename K>
+ShortestPaths Graph<D, K>::shortest_paths(K s)
+{
+    GRAPH_STATS_CALL("shortest_paths");
+    ShortestPaths r;
+    dijkstra(id_of(s), -1, r);
+    return r;
+}
+
+// Delta-stepping (Meyer and Sanders): vertices wait in buckets of width delta.
+// Light edges (weight <= delta) are relaxed until the current bucket stops
+// refilling, then the heavy edges of everything it settled are relaxed once.
+// Each round of relaxations runs on the thread pool, with distances stored as
+// the bits of non-negative doubles, which order the same way.
+// Precondition: none
+// Postcondition: returns the same distances as shortest_paths(s); parents
+//                form a shortest-path tree; order is empty
+
+template <typename D, typename K>
+ShortestPaths Graph<D, K>::delta_stepping(K s, double delta)
+{
+    GRAPH_STATS_CALL("delta_stepping");
+    size_t n = id_to_vertex.size();
+    ShortestPaths r;
+    r.begin(n);
+    int src = id_of(s);
+    if (src < 0) return r;
+
+    const vector<double> &w = csr_weights();
+    if (!(delta > 0)) {
+        double total = 0;
+        for (double x : w) total += x;
+        delta = w.empty() ? 1 : total / w.size();
+        if (!(delta > 0)) delta = 1; // Every edge weighs 0
+    }
+
+    GRAPH_STATS_PHASE(search);
+    const uint64_t unreached = bit_cast<uint64_t>(numeric_limits<double>::infinity());
+    unique_ptr<atomic<uint64_t>[]> dist(new atomic<uint64_t>[n]);
+    for (size_t id = 0; id < n; id++) {
+        dist[id].store(unreached, memory_order_relaxed);
+    }
+    auto distance = [&](int id) { return bit_cast<double>(dist[id].load(memory_order_relaxed)); };
+    dist[src].store(bit_cast<uint64_t>(0.0), memory_order_relaxed);
+
+    vector<vector<int>> buckets{{src}};
+    vector<double> expanded(n, numeric_limits<double>::infinity()); // Distance each vertex was expanded at
+    unsigned workers = get_threads();
+    vector<vector<int>> improved(workers); // Per-thread relaxation results
+
+    auto relax = [&](const vector<int> &frontier, bool light) {
+        size_t chunk = (frontier.size() + workers - 1) / workers;
+        function<void(size_t)> task = [&](size_t t) {
+            improved[t].clear();
+            size_t lo = min(frontier.size(), t * chunk);
+            size_t hi = min(frontier.size(), lo + chunk);
+            for (size_t i = lo; i < hi; i++) {
+                int u = frontier[i];
+                double du = distance(u);
+                for (size_t e = offsets[u]; e < ends[u]; e++) {
+                    double we = w.empty() ? 1 : w[e];
+                    if ((we <= delta) != light) continue;
+
+                    uint64_t nd = bit_cast<uint64_t>(du + we);
+                    uint64_t cur = dist[neighbors[e]].load(memory_order_relaxed);
+                    while (nd < cur) {
+                        if (dist[neighbors[e]].compare_exchange_weak(cur, nd, memory_order_relaxed)) {
+                            improved[t].push_back(neighbors[e]);
+                            break;
+                        }
+                    }
+                }
+            }
+        };
+        if (workers > 1 && frontier.size() >= PARALLEL_MIN_FRONTIER) {
+            ThreadPool::shared().run(workers, task);
+        } else {
+            for (unsigned t = 0; t < workers; t++) task(t);
+        }
+
+        for (const vector<int> &ids : improved) {
+            for (int v : ids) {
+                size_t b = size_t(distance(v) / delta);
+                if (b >= buckets.size()) buckets.resize(b + 1);
+                buckets[b].push_back(v);
+            }
+        }
+    };
+
+    for (size_t i = 0; i < buckets.size(); i++) {
+        vector<int> settled;
+        while (!buckets[i].empty()) {
+            // Skip entries that moved to an earlier bucket or were already expanded
+            vector<int> frontier;
+            for (int v : buckets[i]) {
+                double d = distance(v);
+                if (size_t(d / delta) == i && d < expanded[v]) {
+                    expanded[v] = d;
+                    frontier.push_back(v);
+                }
+            }
+            buckets[i].clear();
+            GRAPH_STATS_MAX(queue_peak, frontier.size());
+            settled.insert(settled.end(), frontier.begin(), frontier.end());
+            relax(frontier, true);
+        }
+        relax(settled, false);
+    }
+
+    // Parents along tight edges (d[u] + w == d[v]), searched outward from the
+    // source so zero-weight cycles cannot produce a parent cycle
+    r.source = src;
+    r.set(src, 0, -1);
+    vector<int> queue{src};
+    for (size_t head = 0; head < queue.size(); head++) {
+        int u = queue[head];
+        GRAPH_STATS_ADD(vertices_visited, 1);
+        for (size_t e = offsets[u]; e < ends[u]; e++) {
+            int v = neighbors[e];
+            GRAPH_STATS_ADD(edges_scanned, 1);
+            if (!r.reached(v) && r.dist[u] + (w.empty() ? 1 : w[e]) == distance(v)) {
+                r.set(v, distance(v), u);
+                queue.push_back(v);
+            }
+        }
+    }
+    return r;
+}
+
+// Precondition: none
+// Postcondition: returns a minimum-weight path from u to v (keys, u first), or
+//                an empty vector if v is unreachable or a key is missing
+
+template <typename D, typename K>
+vector<K> Graph<D, K>::shortest_path(K u, K v)
+{
+    GRAPH_STATS_CALL("shortest_path");
+    int target = id_of(v);
+    static thread_local ShortestPaths r;
+    dijkstra(id_of(u), target, r);
+    if (target < 0 || !r.reached(target)) return {};
+
+    vector<K> path;
+    for (int x = target; x != -1; x = r.parent(x)) {
+        path.push_back(key_of(x));
+    }
+    reverse(path.begin(), path.end());
+    return path;
+}
+
+// Precondition: none
+// Postcondition: returns the weight of a minimum-weight path from u to v, or
+//                infinity if there is none
+
+template <typename D, typename K>
+double Graph<D, K>::shortest_distance(K u, K v)
+{
+    GRAPH_STATS_CALL("shortest_distance");
+    int target = id_of(v);
+    static thread_local ShortestPaths r;
+    dijkstra(id_of(u), target, r);
+    return target < 0 ? numeric_limits<double>::infinity() : r.distance(target);
+}
+
+// Precondition: none
+// Postcondition: prints a minimum-weight path from u to v in the format of
+//                print_path(), or nothing if there is none
+
+template <typename D, typename K>
+void Graph<D, K>::print_shortest_path(K u, K v)
+{
+    GRAPH_STATS_CALL("print_shortest_path");
+    vector<K> path = shortest_path(u, v);
+    for (size_t i = 0; i < path.size(); i++) {
+        if (i > 0) cout << " -> ";
+        cout << path[i];
+    }
+}
+
+// ========================================
+// Compressed Adjacency
+// ========================================
+
+template <typename D, typename K>
+template <typename F>
+decltype(auto) Graph<D, K>::with_rows(F fn) const
+{
+    if (compressed) return fn(packed_out, packed_in);
+    return fn(PlainRows{offsets.data(), ends.data(), neighbors.data()},
+              PlainRows{rev_offsets.data(), rev_ends.data(), rev_neighbors.data()});
+}
+
+// Precondition: none
+// Postcondition: the rows are stored as varint deltas and the plain CSR
+//                arrays are freed; returns the adjacency size before and after
+
+template <typename D, typename K>
+CompressionStats Graph<D, K>::compress()
+{
+    compact(); // Packed rows without tombstones
+    size_t n = id_to_vertex.size();
+    CompressionStats stats;
+    stats.edges = edge_count;
+    stats.plain_bytes = 2 * ((n + 1) * sizeof(size_t) + edge_count * sizeof(int));
+    if (!compressed) {
+        if (!packed_out.encode(n, offsets.data(), ends.data(), neighbors.data()) ||
+            !packed_in.encode(n, rev_offsets.data(), rev_ends.data(), rev_neighbors.data())) {
+            packed_out.clear();
+            return stats;
+        }
+        ends.view(nullptr, 0);
+        rev_ends.view(nullptr, 0);
+        offsets.set(vector<size_t>());
+        neighbors.set(vector<int>());
+        rev_offsets.set(vector<size_t>());
+        rev_neighbors.set(vector<int>());
+        compressed = true;
+
+        // Rows keep their order, so searches and the reachability index are unchanged
+        bool index_current = has_reachability_index();
+        version++;
+        if (index_current) reach_index.version = version;
+    }
+
+    stats.compressed_bytes = packed_out.memory_bytes() + packed_in.memory_bytes();
+    return stats;
+}
+
+// Precondition: none
+// Postcondition: the rows are plain CSR arrays again, exactly as compress()
+//                found them
+
+template <typename D, typename K>
+void Graph<D, K>::decompress()
+{
+    lock_guard<mutex> lock(cache_lock);
+    if (!compressed) return;
+
+    size_t n = id_to_vertex.size();
+    vector<size_t> off(n + 1, 0);
+    vector<int> nbr;
+    nbr.reserve(edge_count);
+    for (size_t u = 0; u < n; u++) {
+        for (int v : packed_out.row(u)) {
+            nbr.push_back(v);
+        }
+        off[u + 1] = nbr.size();
+    }
+    set_csr(move(off), move(nbr));
+
+    bool index_current = has_reachability_index();
+    version++;
+    if (index_current) reach_index.version = version;
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::is_compressed() const
+{
+    return compressed;
+}
+
+// ========================================
+// Vertex Order
+// ========================================
+
+// Precondition: none
+// Postcondition: ids are numbered in order; keys, data and edges are unchanged
+
+template <typename D, typename K>
+void Graph<D, K>::reorder(VertexOrder order)
+{
+    bool was_compressed = compressed;
+    decompress();
+    if (snapshot) rebuild(); // The order is computed from the vertices
+
+    id_order = order;
+    renumber(ordered_ids());
+    if (was_compressed) compress();
+}
+
+template <typename D, typename K>
+VertexOrder Graph<D, K>::get_vertex_order() const
+{
+    return id_order;
+}
+
+// Precondition: the graph is materialized and not compressed
+// Postcondition: returns every live id once, in the order of id_order
+
+template <typename D, typename K>
+vector<int> Graph<D, K>::ordered_ids() const
+{
+    vector<int> by_key;
+    by_key.reserve(vertices.size());
+    for (auto& pair : vertices) {
+        by_key.push_back(pair.second->id);
+    }
+    if (id_order == VertexOrder::KEYS) return by_key;
+
+    auto degree = [&](int id) { return (ends[id] - offsets[id]) + (rev_ends[id] - rev_offsets[id]); };
+    if (id_order == VertexOrder::DEGREE) {
+        stable_sort(by_key.begin(), by_key.end(), [&](int a, int b) { return degree(a) > degree(b); });
+        return by_key;
+    }
+
+    // BFS follows out-edges from each unvisited vertex in key order. RCM
+    // follows edges both ways from each unvisited vertex of least degree,
+    // queueing neighbors by increasing degree, and reverses the result.
+    bool rcm = id_order == VertexOrder::RCM;
+    if (rcm) {
+        stable_sort(by_key.begin(), by_key.end(), [&](int a, int b) { return degree(a) < degree(b); });
+    }
+    vector<bool> seen(id_to_vertex.size(), false);
+    vector<int> order;
+    order.reserve(by_key.size());
+    for (int s : by_key) {
+        if (seen[s]) continue;
+        seen[s] = true;
+        order.push_back(s);
+        for (size_t head = order.size() - 1; head < order.size(); head++) {
+            int u = order[head];
+            size_t first = order.size();
+            for (size_t e = offsets[u]; e < ends[u]; e++) {
+                int v = neighbors[e];
+                if (!seen[v]) {
+                    seen[v] = true;
+                    order.push_back(v);
+                }
+            }
+            if (!rcm) continue;
+            for (size_t e = rev_offsets[u]; e < rev_ends[u]; e++) {
+                int v = rev_neighbors[e];
+                if (!seen[v]) {
+                    seen[v] = true;
+                    order.push_back(v);
+                }
+            }
+            stable_sort(order.begin() + first, order.end(), [&](int a, int b) { return degree(a) < degree(b); });
+        }
+    }
+    if (rcm) reverse(order.begin(), order.end());
+    return order;
+}
+
+// ========================================
+// Topological Order
+// ========================================
+
+// Precondition: none
+// Postcondition: see the declaration; runs in O(V + E)
+
+template <typename D, typename K>
+bool Graph<D, K>::topological_sort(vector<K> &order, vector<K> &cycle) const
+{
+    GRAPH_STATS_CALL("topological_sort");
+    GRAPH_STATS_PHASE(search);
+    order.clear();
+    cycle.clear();
+
+    // In-degrees come straight from the reverse rows; ready vertices wait in a
+    // min-heap of their positions in key order, so ties are broken by key
+    return with_rows([&](const auto &out, const auto &in) {
+        size_t n = id_to_vertex.size();
+        vector<int> indegree(n, 0);
+        vector<int> rank(n, 0);
+        vector<int> by_rank; // Ids in key order
+        for_each_id([&](int id) {
+            indegree[id] = in.degree(id);
+            rank[id] = by_rank.size();
+            by_rank.push_back(id);
+        });
+        size_t live = by_rank.size();
+
+        vector<int> ready; // Ascending, so already a heap
+        for (size_t r = 0; r < live; r++) {
+            if (indegree[by_rank[r]] == 0) ready.push_back(r);
+        }
+        vector<int> sorted;
+        sorted.reserve(live);
+        while (!ready.empty()) {
+            GRAPH_STATS_MAX(queue_peak, ready.size());
+            pop_heap(ready.begin(), ready.end(), greater<int>());
+            int u = by_rank[ready.back()];
+            ready.pop_back();
+            sorted.push_back(u);
+            GRAPH_STATS_ADD(vertices_visited, 1);
+            for (int v : out.row(u)) {
+                GRAPH_STATS_ADD(edges_scanned, 1);
+                if (--indegree[v] == 0) {
+                    ready.push_back(rank[v]);
+                    push_heap(ready.begin(), ready.end(), greater<int>());
+                }
+            }
+        }
+
+        if (sorted.size() == live) {
+            order.reserve(live);
+            for (int id : sorted) {
+                order.push_back(key_of(id));
+            }
+            return true;
+        }
+
+        // Every vertex left over still has a predecessor that is left over, so
+        // walking predecessors from any of them must come back around
+        int start = -1;
+        for_each_id([&](int id) {
+            if (start < 0 && indegree[id] > 0) start = id;
+        });
+        vector<int> step(n, -1); // Position of each vertex on the walk
+        vector<int> walk;
+        int u = start;
+        while (step[u] < 0) {
+            step[u] = walk.size();
+            walk.push_back(u);
+            for (int p : in.row(u)) {
+                if (indegree[p] > 0) {
+                    u = p;
+                    break;
+                }
+            }
+        }
+
+        // The walk followed edges backwards, so the cycle reads it in reverse
+        for (int i = walk.size() - 1; i >= step[u]; i--) {
+            cycle.push_back(key_of(walk[i]));
+        }
+        return false;
+    });
+}
+
+// Each worker owns a deque of ready vertices: it pushes and pops at the back
+// (the successors it just released, still warm in cache) and steals from the
+// front of the others' deques when its own is empty.
+// Precondition: fn may be called from several threads at once
+// Postcondition: fn has returned for every vertex, or the graph has a cycle
+
+template <typename D, typename K>
+bool Graph<D, K>::for_each_wavefront(const function<void(const K &)> &fn, unsigned workers)
+{
+    vector<K> order, cycle;
+    if (!topological_sort(order, cycle)) return false;
+    decompress();
+    if (order.empty()) return true;
+    if (workers == 0) workers = get_threads();
+
+    size_t n = id_to_vertex.size();
+    unique_ptr<atomic<int>[]> pending(new atomic<int>[n]); // Predecessors not yet finished
+    vector<deque<int>> ready(workers);
+    unique_ptr<mutex[]> locks(new mutex[workers]);
+    size_t next = 0;
+    for_each_id([&](int id) {
+        int indegree = rev_ends[id] - rev_offsets[id];
+        pending[id].store(indegree, memory_order_relaxed);
+        if (indegree == 0) ready[next++ % workers].push_back(id);
+    });
+
+    // Keys are resolved before the workers start, so no vertex is materialized concurrently
+    vector<K> keys(n);
+    for_each_id([&](int id) { keys[id] = key_of(id); });
+
+    // Idle workers sleep until a vertex is queued or everything has finished;
+    // producers only take the lock to wake them when someone is asleep
+    atomic<size_t> finished{0};
+    atomic<size_t> queued{next}; // Counted before the push, uncounted after the pop
+    atomic<unsigned> sleepers{0};
+    mutex idle_lock;
+    condition_variable wake;
+    size_t total = order.size();
+    ThreadPool::shared().run(workers, [&](size_t t) {
+        while (finished.load(memory_order_acquire) < total) {
+            int u = -1;
+            {
+                lock_guard<mutex> lock(locks[t]);
+                if (!ready[t].empty()) {
+                    u = ready[t].back();
+                    ready[t].pop_back();
+                }
+            }
+            for (unsigned i = 1; u < 0 && i < workers; i++) {
+                size_t victim = (t + i) % workers;
+                lock_guard<mutex> lock(locks[victim]);
+                if (!ready[victim].empty()) {
+                    u = ready[victim].front();
+                    ready[victim].pop_front();
+                }
+            }
+            if (u < 0) {
+                // Everything ready is running elsewhere
+                unique_lock<mutex> lock(idle_lock);
+                sleepers++;
+                wake.wait(lock, [&] { return queued.load() > 0 || finished.load() >= total; });
+                sleepers--;
+                continue;
+            }
+            queued--;
+
+            fn(keys[u]);
+            for (size_t e = offsets[u]; e < ends[u]; e++) {
+                int v = neighbors[e];
+                if (pending[v].fetch_sub(1, memory_order_acq_rel) == 1) {
+                    queued++;
+                    {
+                        lock_guard<mutex> lock(locks[t]);
+                        ready[t].push_back(v);
+                    }
+                    if (sleepers.load() > 0) {
+                        lock_guard<mutex> lock(idle_lock);
+                        wake.notify_one();
+                    }
+                }
+            }
+            if (finished.fetch_add(1, memory_order_acq_rel) + 1 == total) {
+                lock_guard<mutex> lock(idle_lock);
+                wake.notify_all();
+            }
+        }
+    });
+    return true;
+}
+
+// ========================================
+// Dynamic Updates
+// ========================================
+
+template <typename D, typename K>
+bool Graph<D, K>::add_vertex(K key, D data)
+{
+    bool changed = update({GraphUpdate<D, K>::ADD_VERTEX, key, K(), data});
+    compact_if_sparse();
+    return changed;
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::remove_vertex(K key)
+{
+    bool changed = update({GraphUpdate<D, K>::REMOVE_VERTEX, key});
+    compact_if_sparse();
+    return changed;
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::add_edge(K u, K v, double weight)
+{
+    bool changed = update({GraphUpdate<D, K>::ADD_EDGE, u, v, D(), weight});
+    compact_if_sparse();
+    return changed;
+}
+
+template <typename D, typename K>
+bool Graph<D, K>::remove_edge(K u, K v)
+{
+    bool changed = update({GraphUpdate<D, K>::REMOVE_EDGE, u, v});
+    compact_if_sparse();
+    return changed;
+}
+
+template <typename D, typename K>
+size_t Graph<D, K>::apply(const vector<GraphUpdate<D, K>> &updates)
+{
+    size_t changed = 0;
+    for (const GraphUpdate<D, K> &u : updates) {
+        if (update(u)) changed++;
+    }
+    compact_if_sparse();
+    return changed;
+}
+
+// Precondition: none
+// Postcondition: returns true if u changed the graph; adj lists, both CSR
+//                directions and the version reflect the change. Rows keep the
+//                order of the adj lists (including entries that named a vertex
+//                before it was added), so results match a rebuild().
+
+template <typename D, typename K>
+bool Graph<D, K>::update(const GraphUpdate<D, K> &u)
+{
+    decompress();
+    switch (u.kind) {
+    case GraphUpdate<D, K>::ADD_VERTEX: {
+        if (id_of(u.u) >= 0) return false;
+        unpack();
+
+        // Appending keeps ids in key order only if the key sorts last
+        if (!vertices.empty() && !(vertices.rbegin()->first < u.u)) ids_in_key_order = false;
+
+        Vertex<D, K> *v = new Vertex<D, K>(u.u, u.data);
+        v->id = id_to_vertex.size();
+        vertices[u.u] = v;
+        id_to_vertex.push_back(v);
+        key_index.insert(v->key, v->id);
+        dense_insert(v->key, v->id);
+
+        // New rows start empty with no capacity; the first edge moves them
+        offsets.at(v->id) = neighbors.size();
+        offsets.push_back(neighbors.size());
+        ends.push_back(neighbors.size());
+        limits.push_back(neighbors.size());
+        rev_offsets.at(v->id) = rev_neighbors.size();
+        rev_offsets.push_back(rev_neighbors.size());
+        rev_ends.push_back(rev_neighbors.size());
+        rev_limits.push_back(rev_neighbors.size());
+
+        // Adj entries that already named the key become edges; their rows are
+        // refilled in adj order, as rebuild() would lay them out
+        auto named = dangling.find(u.u);
+        if (named == dangling.end()) break;
+        for (const K &key : named->second) {
+            int a = id_of(key);
+            if (a < 0) continue;
+            const Vertex<D, K> *x = id_to_vertex[a];
+            size_t added = count(x->adj.begin(), x->adj.end(), u.u);
+            if (added == 0) continue;
+
+            ends.at(a) = offsets[a];
+            for (const K &w : x->adj) {
+                int b = id_of(w);
+                if (b >= 0) row_insert(offsets, ends, limits, neighbors, a, b);
+            }
+            for (size_t i = 0; i < added; i++) {
+                row_insert(rev_offsets, rev_ends, rev_limits, rev_neighbors, v->id, a);
+            }
+            edge_count += added;
+        }
+        dangling.erase(named);
+        break;
+    }
+    case GraphUpdate<D, K>::REMOVE_VERTEX: {
+        int x = id_of(u.u);
+        if (x < 0) return false;
+        unpack();
+
+        // Out-edges disappear from the reverse rows of their targets
+        for (size_t e = offsets[x]; e < ends[x]; e++) {
+            row_erase(rev_offsets, rev_ends, rev_neighbors, neighbors[e], x);
+        }
+        edge_count -= ends[x] - offsets[x];
+
+        // In-edges disappear from the rows and adj lists of their sources
+        vector<int> sources(rev_neighbors.begin() + rev_offsets[x], rev_neighbors.begin() + rev_ends[x]);
+        for (int y : sources) {
+            row_erase(offsets, ends, neighbors, y, x);
+            erase_adj(id_to_vertex[y], u.u);
+            edge_count--;
+        }
+
+        // The id stays behind as a tombstone with empty rows
+        garbage += limits[x] - offsets[x] + rev_limits[x] - rev_offsets[x];
+        ends.at(x) = limits[x] = offsets[x];
+        rev_ends.at(x) = rev_limits[x] = rev_offsets[x];
+        key_index.erase(u.u, [this](int id) -> const K & { return id_to_vertex[id]->key; });
+        if (dense_active) dense_ids[dense_offset(u.u, dense_lo)] = -1;
+        vertices.erase(u.u);
+        delete id_to_vertex[x];
+        id_to_vertex[x] = nullptr;
+        tombstones++;
+        break;
+    }
+    case GraphUpdate<D, K>::ADD_EDGE: {
+        int a = id_of(u.u);
+        int b = id_of(u.v);
+        if (a < 0 || b < 0) return false;
+        if (find(neighbors.begin() + offsets[a], neighbors.begin() + ends[a], b) != neighbors.begin() + ends[a]) {
+            return false;
+        }
+        unpack();
+
+        row_insert(offsets, ends, limits, neighbors, a, b);
+        row_insert(rev_offsets, rev_ends, rev_limits, rev_neighbors, b, a);
+        Vertex<D, K> *x = id_to_vertex[a];
+        if (u.weight != 1 || !x->weights.empty()) {
+            x->weights.resize(x->adj.size(), 1);
+            x->weights.push_back(u.weight);
+        }
+        x->adj.push_back(u.v);
+        edge_count++;
+        break;
+    }
+    case GraphUpdate<D, K>::REMOVE_EDGE: {
+        int a = id_of(u.u);
+        int b = id_of(u.v);
+        if (a < 0 || b < 0) return false;
+        if (find(neighbors.begin() + offsets[a], neighbors.begin() + ends[a], b) == neighbors.begin() + ends[a]) {
+            return false;
+        }
+        unpack();
+
+        row_erase(offsets, ends, neighbors, a, b);
+        row_erase(rev_offsets, rev_ends, rev_neighbors, b, a);
+        erase_adj(id_to_vertex[a], u.v);
+        edge_count--;
+        break;
+    }
+    }
+
+    version++;
+    return true;
+}
+
+// Precondition: none
+// Postcondition: the graph owns writable CSR arrays with a capacity limit per
+//                row; a snapshot graph is fully materialized and unmapped
+
+// Precondition: key is in v->adj
+// Postcondition: the first edge to key and its weight are removed
+
+template <typename D, typename K>
+void Graph<D, K>::erase_adj(Vertex<D, K> *v, const K &key)
+{
+    size_t i = find(v->adj.begin(), v->adj.end(), key) - v->adj.begin();
+    v->adj.erase(v->adj.begin() + i);
+    if (i < v->weights.size()) v->weights.erase(v->weights.begin() + i);
+}
+
+template <typename D, typename K>
+void Graph<D, K>::unpack()
+{
+    if (!packed) return;
+
+    if (snapshot) {
+        for (size_t id = 0; id < id_to_vertex.size(); id++) {
+            vertex_at(id);
+        }
+        index_keys();
+    }
+
+    // ends views offsets, so it is copied first
+    ends.own();
+    rev_ends.own();
+    offsets.own();
+    neighbors.own();
+    rev_offsets.own();
+    rev_neighbors.own();
+    limits.assign(ends.begin(), ends.end());
+    rev_limits.assign(rev_ends.begin(), rev_ends.end());
+    packed = false;
+
+    snapshot_header = nullptr;
+    snapshot.reset();
+}
+
+// Precondition: row is a live id with spare capacity tracked in row_limits
+// Postcondition: value is appended to the row, which moves to the end of slots
+//                with double the capacity if it was full
+
+template <typename D, typename K>
+void Graph<D, K>::row_insert(CsrArray<size_t> &begins, CsrArray<size_t> &row_ends, vector<size_t> &row_limits,
+                             CsrArray<int> &slots, int row, int value)
+{
+    if (row_ends[row] == row_limits[row]) {
+        size_t degree = row_ends[row] - begins[row];
+        size_t start = slots.size();
+        slots.resize(start + max<size_t>(4, 2 * degree));
+        copy(slots.begin() + begins[row], slots.begin() + row_ends[row], &slots.at(start));
+
+        garbage += row_limits[row] - begins[row];
+        begins.at(row) = start;
+        row_ends.at(row) = start + degree;
+        row_limits[row] = slots.size();
+    }
+    slots.at(row_ends[row]) = value;
+    row_ends.at(row)++;
+}
+
+// Precondition: none
+// Postcondition: the first occurrence of value is removed from the row (later
+//                entries shift down to keep their order); returns false if
+//                the row did not contain value
+
+template <typename D, typename K>
+bool Graph<D, K>::row_erase(CsrArray<size_t> &begins, CsrArray<size_t> &row_ends, CsrArray<int> &slots, int row, int value)
+{
+    for (size_t e = begins[row]; e < row_ends[row]; e++) {
+        if (slots[e] != value) continue;
+
+        for (; e + 1 < row_ends[row]; e++) {
+            slots.at(e) = slots[e + 1];
+        }
+        row_ends.at(row)--;
+        return true;
+    }
+    return false;
+}
+
+// Compaction is amortized into the updates: it runs once a quarter of the ids
+// are tombstones or half of the slots are garbage
+template <typename D, typename K>
+void Graph<D, K>::compact_if_sparse()
+{
+    if (tombstones * 4 > id_to_vertex.size() || garbage * 2 > neighbors.size() + rev_neighbors.size()) {
+        compact();
+    }
+}
+
+// Precondition: none
+// Postcondition: ids are dense and in the reorder() order (key order by
+//                default) again and every row is packed; the edges
+//                themselves are unchanged
+
+template <typename D, typename K>
+void Graph<D, K>::compact()
+{
+    // Compressed rows are always compact; appended vertices only break key order
+    if (compressed || (packed && tombstones == 0 && (ids_in_key_order || id_order != VertexOrder::KEYS))) return;
+    renumber(ordered_ids());
+}
+
+// Precondition: order lists every live id once; the graph is not compressed
+// Postcondition: order[i] is now id i and every row is packed
+
+template <typename D, typename K>
+void Graph<D, K>::renumber(const vector<int> &order)
+{
+    // Rows are copied without resolving any keys
+    vector<int> new_id(id_to_vertex.size(), -1);
+    vector<Vertex<D, K> *> by_id(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        new_id[order[i]] = i;
+        by_id[i] = id_to_vertex[order[i]];
+    }
+
+    vector<size_t> off(order.size() + 1, 0);
+    vector<int> nbr;
+    nbr.reserve(edge_count);
+    for (size_t i = 0; i < order.size(); i++) {
+        int old = order[i];
+        for (size_t e = offsets[old]; e < ends[old]; e++) {
+            nbr.push_back(new_id[neighbors[e]]);
+        }
+        off[i + 1] = nbr.size();
+    }
+
+    for (size_t i = 0; i < by_id.size(); i++) {
+        by_id[i]->id = i;
+    }
+    id_to_vertex.swap(by_id);
+    key_index.remap(new_id);
+    index_dense_keys();
+    set_csr(move(off), move(nbr));
+    ids_in_key_order = id_order == VertexOrder::KEYS;
+    tombstones = 0;
+
+    // Ids changed, so the next bfs() resets every vertex
+    mark_all_bfs_touched();
+    bfs_source = -1;
+    version++;
+}
+
+// ========================================
+// Snapshots
+// ========================================
+
+// Precondition: none
+// Postcondition: path holds the graph in the SnapshotHeader layout; returns
+//                false if the file could not be written. The file is written
+//                to path + ".tmp" and renamed over path, so a graph opened
+//                from path keeps reading its mapping while it is saved.
+
+template <typename D, typename K>
+bool Graph<D, K>::save_snapshot(const string &path)
+{
+    static_assert(is_same_v<K, string> || is_trivially_copyable_v<K>, "snapshot keys must be string or trivially copyable");
+    static_assert(is_same_v<D, string> || is_trivially_copyable_v<D>, "snapshot data must be string or trivially copyable");
+
+    string tmp = path + ".tmp";
+    ofstream out(tmp, ios::binary | ios::trunc);
+    if (!out) return false;
+
+    decompress();
+    compact(); // The file layout has no tombstones or spare capacity
+    size_t n = id_to_vertex.size();
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "GRAPHSNP", 8);
+    h.format_version = SnapshotHeader::FORMAT_VERSION;
+    h.key_kind = is_same_v<K, string> ? 0 : sizeof(K);
+    h.data_kind = is_same_v<D, string> ? 0 : sizeof(D);
+    h.vertex_order = uint32_t(id_order);
+    h.vertex_count = n;
+    h.edge_count = neighbors.size();
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h)); // Rewritten with the checksum at the end
+
+    uint64_t pos = sizeof(h);
+    uint64_t checksum = snapshot_checksum(nullptr, 0);
+    auto write_section = [&](int section, const void *p, size_t bytes) {
+        static const char padding[8] = {};
+        size_t pad = (8 - pos % 8) % 8;
+        out.write(padding, pad);
+        checksum = snapshot_checksum(padding, pad, checksum);
+        pos += pad;
+
+        h.section_offset[section] = pos;
+        h.section_bytes[section] = bytes;
+        out.write(static_cast<const char *>(p), bytes);
+        checksum = snapshot_checksum(p, bytes, checksum);
+        pos += bytes;
+    };
+
+    // Ids in key order, for binary search on open
+    vector<int> key_order;
+    key_order.reserve(n);
+    if (snapshot) {
+        const int *order = reinterpret_cast<const int *>(snapshot_section(SnapshotHeader::KEY_ORDER));
+        key_order.assign(order, order + n);
+    } else {
+        for (auto &pair : vertices) key_order.push_back(pair.second->id);
+    }
+    write_section(SnapshotHeader::KEY_ORDER, key_order.data(), n * sizeof(int));
+
+    // Keys and data: fixed-size records, or offsets into a character blob
+    auto write_values = [&](int offsets_section, int values_section, auto value_of) {
+        using T = decltype(value_of(0));
+        if constexpr (is_same_v<T, string>) {
+            vector<uint64_t> starts(n + 1, 0);
+            string chars;
+            for (size_t id = 0; id < n; id++) {
+                chars += value_of(id);
+                starts[id + 1] = chars.size();
+            }
+            write_section(offsets_section, starts.data(), starts.size() * sizeof(uint64_t));
+            write_section(values_section, chars.data(), chars.size());
+        } else {
+            vector<T> values(n);
+            for (size_t id = 0; id < n; id++) values[id] = value_of(id);
+            write_section(offsets_section, nullptr, 0);
+            write_section(values_section, values.data(), n * sizeof(T));
+        }
+    };
+    write_values(SnapshotHeader::KEY_OFFSETS, SnapshotHeader::KEYS, [&](size_t id) { return key_of(id); });
+    write_values(SnapshotHeader::DATA_OFFSETS, SnapshotHeader::DATA, [&](size_t id) {
+        return id_to_vertex[id] != nullptr ? id_to_vertex[id]->data : snapshot_data(id);
+    });
+
+    write_section(SnapshotHeader::OFFSETS, offsets.data(), offsets.size() * sizeof(size_t));
+    write_section(SnapshotHeader::NEIGHBORS, neighbors.data(), neighbors.size() * sizeof(int));
+    write_section(SnapshotHeader::REV_OFFSETS, rev_offsets.data(), rev_offsets.size() * sizeof(size_t));
+    write_section(SnapshotHeader::REV_NEIGHBORS, rev_neighbors.data(), rev_neighbors.size() * sizeof(int));
+
+    h.checksum = checksum;
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    out.close();
+    if (out.fail() || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Precondition: none
+// Postcondition: returns a graph whose CSR arrays and key dictionary point into
+//                the mapped file, or nullptr if the file is missing, truncated,
+//                of another format version or key/data type, or corrupt. The
+//                section extents, offsets and ids are checked even without
+//                verify, which only adds the checksum over the whole file.
+
+template <typename D, typename K>
+Graph<D, K> *Graph<D, K>::open_snapshot(const string &path, bool verify)
+{
+    static_assert(is_same_v<K, string> || is_trivially_copyable_v<K>, "snapshot keys must be string or trivially copyable");
+    static_assert(is_same_v<D, string> || is_trivially_copyable_v<D>, "snapshot data must be string or trivially copyable");
+
+    auto file = make_unique<MappedFile>(path);
+    if (!file->is_open() || file->size() < sizeof(SnapshotHeader)) return nullptr;
+
+    const SnapshotHeader *h = reinterpret_cast<const SnapshotHeader *>(file->data());
+    if (memcmp(h->magic, "GRAPHSNP", 8) != 0 || h->format_version != SnapshotHeader::FORMAT_VERSION ||
+        h->key_kind != (is_same_v<K, string> ? 0 : sizeof(K)) ||
+        h->data_kind != (is_same_v<D, string> ? 0 : sizeof(D)) || h->vertex_order > uint32_t(VertexOrder::DEGREE)) {
+        return nullptr;
+    }
+
+    // Every section must lie inside the file and have the size its count implies
+    uint64_t n = h->vertex_count;
+    uint64_t m = h->edge_count;
+    for (int s = 0; s < SnapshotHeader::SECTIONS; s++) {
+        if (h->section_offset[s] > file->size() || h->section_bytes[s] > file->size() - h->section_offset[s]) return nullptr;
+    }
+    if (n > uint64_t(numeric_limits<int>::max()) || m > file->size()) return nullptr;
+    // Offsets sections hold n + 1 values, strings, or nothing for fixed records
+    auto values_fit = [&](int offsets_section, int values_section, uint64_t kind) {
+        if (kind == 0) return h->section_bytes[offsets_section] == (n + 1) * sizeof(uint64_t);
+        return h->section_bytes[offsets_section] == 0 && h->section_bytes[values_section] == n * kind;
+    };
+    if (h->section_bytes[SnapshotHeader::KEY_ORDER] != n * sizeof(int) ||
+        h->section_bytes[SnapshotHeader::OFFSETS] != (n + 1) * sizeof(size_t) ||
+        h->section_bytes[SnapshotHeader::REV_OFFSETS] != (n + 1) * sizeof(size_t) ||
+        h->section_bytes[SnapshotHeader::NEIGHBORS] != m * sizeof(int) ||
+        h->section_bytes[SnapshotHeader::REV_NEIGHBORS] != m * sizeof(int) ||
+        !values_fit(SnapshotHeader::KEY_OFFSETS, SnapshotHeader::KEYS, h->key_kind) ||
+        !values_fit(SnapshotHeader::DATA_OFFSETS, SnapshotHeader::DATA, h->data_kind)) {
+        return nullptr;
+    }
+    for (int s = 0; s < SnapshotHeader::SECTIONS; s++) {
+        if (h->section_bytes[s] > 0 && h->section_offset[s] % 8 != 0) return nullptr;
+    }
+
+    if (verify && snapshot_checksum(file->data() + sizeof(SnapshotHeader), file->size() - sizeof(SnapshotHeader)) != h->checksum) {
+        return nullptr;
+    }
+
+    // Without the checksum the values are still read unchecked on every query:
+    // offsets must rise from 0 to the end of what they index, ids must be < n
+    auto section = [&](int s) { return file->data() + h->section_offset[s]; };
+    auto offsets_valid = [&](int s, uint64_t end) {
+        if (h->section_bytes[s] == 0) return true;
+        const uint64_t *starts = reinterpret_cast<const uint64_t *>(section(s));
+        if (starts[0] != 0 || starts[n] != end) return false;
+        for (uint64_t i = 0; i < n; i++) {
+            if (starts[i] > starts[i + 1]) return false;
+        }
+        return true;
+    };
+    auto ids_valid = [&](int s, uint64_t count) {
+        const int *ids = reinterpret_cast<const int *>(section(s));
+        for (uint64_t i = 0; i < count; i++) {
+            if (ids[i] < 0 || uint64_t(ids[i]) >= n) return false;
+        }
+        return true;
+    };
+    if (!offsets_valid(SnapshotHeader::KEY_OFFSETS, h->section_bytes[SnapshotHeader::KEYS]) ||
+        !offsets_valid(SnapshotHeader::DATA_OFFSETS, h->section_bytes[SnapshotHeader::DATA]) ||
+        !offsets_valid(SnapshotHeader::OFFSETS, m) || !offsets_valid(SnapshotHeader::REV_OFFSETS, m) ||
+        !ids_valid(SnapshotHeader::KEY_ORDER, n) || !ids_valid(SnapshotHeader::NEIGHBORS, m) ||
+        !ids_valid(SnapshotHeader::REV_NEIGHBORS, m)) {
+        return nullptr;
+    }
+
+    Graph *G = new Graph();
+    G->offsets.view(reinterpret_cast<const size_t *>(section(SnapshotHeader::OFFSETS)), n + 1);
+    G->neighbors.view(reinterpret_cast<const int *>(section(SnapshotHeader::NEIGHBORS)), m);
+    G->rev_offsets.view(reinterpret_cast<const size_t *>(section(SnapshotHeader::REV_OFFSETS)), n + 1);
+    G->rev_neighbors.view(reinterpret_cast<const int *>(section(SnapshotHeader::REV_NEIGHBORS)), m);
+    G->ends.view(G->offsets.data() + 1, n);
+    G->rev_ends.view(G->rev_offsets.data() + 1, n);
+    G->edge_count = m;
+    G->id_to_vertex.assign(n, nullptr);
+    G->id_order = VertexOrder(h->vertex_order);
+    G->ids_in_key_order = G->id_order == VertexOrder::KEYS;
+    G->snapshot_header = h;
+    G->snapshot = move(file);
+    G->version++;
+    return G;
+}
+
+// Precondition: 0 <= id < number of vertices
+// Postcondition: returns the vertex with dense id, creating it from the
+//                snapshot (key, data and adj) on first use
+
+template <typename D, typename K>
+Vertex<D, K> *Graph<D, K>::vertex_at(int id)
+{
+    if (id_to_vertex[id] != nullptr) return id_to_vertex[id];
+
+    Vertex<D, K> *v = new Vertex<D, K>(snapshot_key(id), snapshot_data(id));
+    v->id = id;
+    with_rows([&](const auto &out, const auto &) {
+        for (int x : out.row(id)) {
+            v->adj.push_back(snapshot_key(x));
+        }
+    });
+    vertices[v->key] = v;
+    id_to_vertex[id] = v;
+    return v;
+}
+
+template <typename D, typename K>
+const char *Graph<D, K>::snapshot_section(int section) const
+{
+    return snapshot->data() + snapshot_header->section_offset[section];
+}
+
+template <typename D, typename K>
+K Graph<D, K>::snapshot_key(int id) const
+{
+    const char *keys = snapshot_section(SnapshotHeader::KEYS);
+    if constexpr (is_same_v<K, string>) {
+        const uint64_t *starts = reinterpret_cast<const uint64_t *>(snapshot_section(SnapshotHeader::KEY_OFFSETS));
+        return K(keys + starts[id], starts[id + 1] - starts[id]);
+    } else if constexpr (is_trivially_copyable_v<K>) {
+        K key;
+        memcpy(&key, keys + id * sizeof(K), sizeof(K));
+        return key;
+    } else {
+        return K(); // No snapshot holds other key types; see open_snapshot()
+    }
+}
+
+template <typename D, typename K>
+D Graph<D, K>::snapshot_data(int id) const
+{
+    const char *data = snapshot_section(SnapshotHeader::DATA);
+    if constexpr (is_same_v<D, string>) {
+        const uint64_t *starts = reinterpret_cast<const uint64_t *>(snapshot_section(SnapshotHeader::DATA_OFFSETS));
+        return D(data + starts[id], starts[id + 1] - starts[id]);
+    } else if constexpr (is_trivially_copyable_v<D>) {
+        D value;
+        memcpy(&value, data + id * sizeof(D), sizeof(D));
+        return value;
+    } else {
+        return D(); // No snapshot holds other data types; see open_snapshot()
+    }
+}
+
+// Precondition: snapshot is open
+// Postcondition: returns the id of key by binary search over the mapped key
+//                order, or -1 if key is not in the snapshot
+
+template <typename D, typename K>
+int Graph<D, K>::snapshot_find(const K &key) const
+{
+    const int *order = reinterpret_cast<const int *>(snapshot_section(SnapshotHeader::KEY_ORDER));
+    const char *keys = snapshot_section(SnapshotHeader::KEYS);
+    const uint64_t *starts = reinterpret_cast<const uint64_t *>(snapshot_section(SnapshotHeader::KEY_OFFSETS));
+
+    // Compares the key of id with key without building a K
+    auto compare = [&](int id) {
+        if constexpr (is_same_v<K, string>) {
+            return string_view(keys + starts[id], starts[id + 1] - starts[id]).compare(key);
+        } else if constexpr (is_trivially_copyable_v<K>) {
+            K k;
+            memcpy(&k, keys + id * sizeof(K), sizeof(K));
+            return k < key ? -1 : (key < k ? 1 : 0);
+        } else {
+            return 0;
+        }
+    };
+
+    size_t lo = 0;
+    size_t hi = snapshot_header->vertex_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (compare(order[mid]) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < snapshot_header->vertex_count && compare(order[lo]) == 0) return order[lo];
+    return -1;
+}
+
+template <typename D, typename K>
+void Graph<D, K>::mark_all_bfs_touched()
+{
+    bfs_touched.resize(id_to_vertex.size());
+    for (size_t id = 0; id < id_to_vertex.size(); id++) {
+        bfs_touched[id] = id;
+    }
+}
+
+// ========================================
+// Versioned Graph
+// ========================================
+
+template <typename D, typename K>
+VersionedGraph<D, K>::VersionedGraph()
+{
+    VertexTable<D, K> *table = new VertexTable<D, K>();
+    table->index.clear();
+    GraphVersion<D, K> *v = new GraphVersion<D, K>();
+    v->table = table;
+    current.store(v);
+}
+
+// Precondition: none
+// Postcondition: version 0 holds the vertices of G with ids in key order and
+//                the edges of their adj lists that lead to vertices of G
+
+template <typename D, typename K>
+VersionedGraph<D, K>::VersionedGraph(const Graph<D, K> &G)
+{
+    VertexTable<D, K> *table = new VertexTable<D, K>();
+    table->index.clear(G.vertices.size());
+    for (auto &pair : G.vertices) {
+        table->index.insert(pair.first, table->keys.size());
+        table->keys.push_back(pair.first);
+        table->data.push_back(pair.second->data);
+        table->live.push_back(true);
+    }
+
+    GraphVersion<D, K> *v = new GraphVersion<D, K>();
+    v->table = table;
+    int id = 0;
+    for (auto &pair : G.vertices) {
+        if (id % AdjacencyBlock::ROWS == 0) v->blocks.push_back(new AdjacencyBlock());
+        AdjacencyBlock *b = const_cast<AdjacencyBlock *>(v->blocks.back());
+        int i = id % AdjacencyBlock::ROWS;
+        for (const K &key : pair.second->adj) {
+            int target = table->find(key);
+            if (target >= 0) b->targets.push_back(target);
+        }
+        b->offsets[i + 1] = b->targets.size();
+        v->edge_count += b->offsets[i + 1] - b->offsets[i];
+        id++;
+    }
+    // Rows past the last vertex of the last block are empty
+    if (!v->blocks.empty()) {
+        AdjacencyBlock *b = const_cast<AdjacencyBlock *>(v->blocks.back());
+        for (int i = id % AdjacencyBlock::ROWS; i > 0 && i < AdjacencyBlock::ROWS; i++) {
+            b->offsets[i + 1] = b->offsets[i];
+        }
+    }
+    current.store(v);
+}
+
+template <typename D, typename K>
+VersionedGraph<D, K>::~VersionedGraph()
+{
+    for (Retired &r : retired) {
+        for (const AdjacencyBlock *b : r.blocks) delete b;
+        delete r.table;
+        delete r.version;
+    }
+    const GraphVersion<D, K> *v = current.load();
+    for (const AdjacencyBlock *b : v->blocks) delete b;
+    delete v->table;
+    delete v;
+}
+
+// A reader announces the epoch it starts in before loading the version. A
+// version retired at epoch R was replaced before the epoch reached R, so only
+// readers that announced an epoch below R can hold it.
+// Precondition: none
+// Postcondition: returns the current version, protected until the Reader is destroyed
+
+template <typename D, typename K>
+typename VersionedGraph<D, K>::Reader VersionedGraph<D, K>::pin() const
+{
+    atomic<uint64_t> *slot = claim_slot();
+    if (slot == nullptr) {
+        // A reader that frees its slot after slot_waiters went up notifies
+        // under the lock; one that freed it before is seen by the rescan
+        unique_lock<mutex> lock(slot_mutex);
+        slot_waiters++;
+        slot_freed.wait(lock, [&] { return (slot = claim_slot()) != nullptr; });
+        slot_waiters--;
+    }
+    return Reader(this, slot, current.load());
+}
+
+// Precondition: none
+// Postcondition: returns a slot now holding the current epoch, or nullptr
+//                if every slot is taken
+
+template <typename D, typename K>
+atomic<uint64_t> *VersionedGraph<D, K>::claim_slot() const
+{
+    static thread_local size_t hint = hash<thread::id>()(this_thread::get_id());
+    for (size_t n = 0; n < READER_SLOTS; n++) {
+        size_t i = (hint + n) % READER_SLOTS;
+        atomic<uint64_t> &slot = slots[i].epoch;
+        uint64_t idle = IDLE;
+        if (slot.load(memory_order_relaxed) == IDLE && slot.compare_exchange_strong(idle, global_epoch.load())) {
+            hint = i;
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+template <typename D, typename K>
+size_t VersionedGraph<D, K>::apply(const vector<GraphUpdate<D, K>> &updates)
+{
+    lock_guard<mutex> lock(writer);
+    const GraphVersion<D, K> *old = current.load();
+    GraphVersion<D, K> *next = new GraphVersion<D, K>(*old);
+    VertexTable<D, K> *table = nullptr;             // Private copy, made by the first vertex update
+    unordered_map<size_t, AdjacencyBlock *> copies; // Block index -> private copy
+    vector<const AdjacencyBlock *> replaced;
+
+    auto own_table = [&]() {
+        if (table == nullptr) {
+            table = new VertexTable<D, K>(*old->table);
+            next->table = table;
+        }
+        return table;
+    };
+    auto writable = [&](int id) -> AdjacencyBlock & {
+        size_t b = id / AdjacencyBlock::ROWS;
+        auto it = copies.find(b);
+        if (it != copies.end()) return *it->second;
+        AdjacencyBlock *copy;
+        if (b < next->blocks.size()) {
+            copy = new AdjacencyBlock(*next->blocks[b]);
+            replaced.push_back(next->blocks[b]);
+            next->blocks[b] = copy;
+        } else {
+            copy = new AdjacencyBlock(); // Ids are appended one at a time
+            next->blocks.push_back(copy);
+        }
+        copies[b] = copy;
+        return *copy;
+    };
+    auto has_edge = [&](int a, int b) {
+        auto row = next->row(a);
+        return find(row.first, row.second, b) != row.second;
+    };
+
+    size_t changed = 0;
+    for (const GraphUpdate<D, K> &u : updates) {
+        int a = next->table->find(u.u);
+        switch (u.kind) {
+        case GraphUpdate<D, K>::ADD_VERTEX: {
+            if (a >= 0) continue;
+            VertexTable<D, K> *t = own_table();
+            int id = t->keys.size();
+            t->index.insert(u.u, id);
+            t->keys.push_back(u.u);
+            t->data.push_back(u.data);
+            t->live.push_back(true);
+            writable(id);
+            break;
+        }
+        case GraphUpdate<D, K>::REMOVE_VERTEX: {
+            if (a < 0) continue;
+            VertexTable<D, K> *t = own_table();
+            t->index.erase(u.u, [t](int id) -> const K & { return t->keys[id]; });
+            t->live[a] = false;
+            next->edge_count -= row_erase(writable(a), a % AdjacencyBlock::ROWS, -1, true);
+
+            // In-edges: only the blocks that hold one are copied
+            for (size_t b = 0; b < next->blocks.size(); b++) {
+                const vector<int> &targets = next->blocks[b]->targets;
+                if (find(targets.begin(), targets.end(), a) == targets.end()) continue;
+                for (int i = 0; i < AdjacencyBlock::ROWS; i++) {
+                    next->edge_count -= row_erase(writable(b * AdjacencyBlock::ROWS), i, a, true);
+                }
+            }
+            break;
+        }
+        case GraphUpdate<D, K>::ADD_EDGE: {
+            int b = next->table->find(u.v);
+            if (a < 0 || b < 0 || has_edge(a, b)) continue;
+            row_insert(writable(a), a % AdjacencyBlock::ROWS, b);
+            next->edge_count++;
+            break;
+        }
+        case GraphUpdate<D, K>::REMOVE_EDGE: {
+            int b = next->table->find(u.v);
+            if (a < 0 || b < 0 || !has_edge(a, b)) continue;
+            next->edge_count -= row_erase(writable(a), a % AdjacencyBlock::ROWS, b, false);
+            break;
+        }
+        }
+        changed++;
+    }
+
+    if (changed == 0) {
+        delete next;
+        return 0;
+    }
+
+    // Publish, then retire what only the old version referenced
+    next->number = old->number + 1;
+    current.store(next);
+    uint64_t epoch = global_epoch.fetch_add(1) + 1;
+    retired.push_back({epoch, old, table != nullptr ? old->table : nullptr, move(replaced)});
+    reclaim();
+    return changed;
+}
+
+// Precondition: the writer lock is held
+// Postcondition: every retired version no pinned reader can see is freed
+
+template <typename D, typename K>
+void VersionedGraph<D, K>::reclaim()
+{
+    uint64_t oldest = IDLE;
+    for (const ReaderSlot &s : slots) {
+        oldest = min(oldest, s.epoch.load());
+    }
+    auto freed = remove_if(retired.begin(), retired.end(), [&](const Retired &r) {
+        if (r.epoch > oldest) return false;
+        for (const AdjacencyBlock *b : r.blocks) delete b;
+        delete r.table;
+        delete r.version;
+        return true;
+    });
+    retired.erase(freed, retired.end());
+}
+
+// Precondition: 0 <= i < ROWS
+// Postcondition: value is appended to row i of b
+
+template <typename D, typename K>
+void VersionedGraph<D, K>::row_insert(AdjacencyBlock &b, int i, int value)
+{
+    b.targets.insert(b.targets.begin() + b.offsets[i + 1], value);
+    for (int j = i + 1; j <= AdjacencyBlock::ROWS; j++) {
+        b.offsets[j]++;
+    }
+}
+
+// Precondition: 0 <= i < ROWS
+// Postcondition: the first (or every, if all) occurrence of value is erased
+//                from row i of b, or the whole row if value is -1; returns
+//                the number of targets erased
+
+template <typename D, typename K>
+size_t VersionedGraph<D, K>::row_erase(AdjacencyBlock &b, int i, int value, bool all)
+{
+    auto first = b.targets.begin() + b.offsets[i];
+    auto last = b.targets.begin() + b.offsets[i + 1];
+    auto kept = first;
+    for (auto it = first; it != last; ++it) {
+        bool erase = value < 0 || (*it == value && (all || kept == it));
+        if (!erase) *kept++ = *it;
+    }
+    size_t erased = last - kept;
+    b.targets.erase(kept, last);
+    for (int j = i + 1; j <= AdjacencyBlock::ROWS; j++) {
+        b.offsets[j] -= erased;
+    }
+    return erased;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::add_vertex(K key, D data)
+{
+    return apply({{GraphUpdate<D, K>::ADD_VERTEX, key, K(), data}}) > 0;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::remove_vertex(K key)
+{
+    return apply({{GraphUpdate<D, K>::REMOVE_VERTEX, key}}) > 0;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::add_edge(K u, K v)
+{
+    return apply({{GraphUpdate<D, K>::ADD_EDGE, u, v}}) > 0;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::remove_edge(K u, K v)
+{
+    return apply({{GraphUpdate<D, K>::REMOVE_EDGE, u, v}}) > 0;
+}
+
+template <typename D, typename K>
+unsigned long VersionedGraph<D, K>::version() const
+{
+    return current.load()->number;
+}
+
+template <typename D, typename K>
+size_t VersionedGraph<D, K>::retired_versions() const
+{
+    lock_guard<mutex> lock(writer);
+    return retired.size();
+}
+
+template <typename D, typename K>
+VersionedGraph<D, K>::Reader::Reader(Reader &&other) noexcept : owner(other.owner), slot(other.slot), v(other.v)
+{
+    other.slot = nullptr;
+}
+
+template <typename D, typename K>
+VersionedGraph<D, K>::Reader::~Reader()
+{
+    if (slot == nullptr) return;
+    slot->store(IDLE);
+    if (owner->slot_waiters.load() > 0) {
+        lock_guard<mutex> lock(owner->slot_mutex);
+        owner->slot_freed.notify_all();
+    }
+}
+
+template <typename D, typename K>
+unsigned long VersionedGraph<D, K>::Reader::version() const
+{
+    return v->number;
+}
+
+template <typename D, typename K>
+size_t VersionedGraph<D, K>::Reader::vertex_count() const
+{
+    return v->table->index.size();
+}
+
+template <typename D, typename K>
+size_t VersionedGraph<D, K>::Reader::edge_count() const
+{
+    return v->edge_count;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::Reader::contains(K key) const
+{
+    return v->table->find(key) >= 0;
+}
+
+template <typename D, typename K>
+const D *VersionedGraph<D, K>::Reader::data(K key) const
+{
+    int id = v->table->find(key);
+    return id < 0 ? nullptr : &v->table->data[id];
+}
+
+template <typename D, typename K>
+vector<K> VersionedGraph<D, K>::Reader::neighbors(K key) const
+{
+    vector<K> keys;
+    int id = v->table->find(key);
+    if (id < 0) return keys;
+    auto row = v->row(id);
+    for (const int *p = row.first; p != row.second; p++) {
+        keys.push_back(v->table->keys[*p]);
+    }
+    return keys;
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::Reader::has_edge(K u, K w) const
+{
+    int a = v->table->find(u);
+    int b = v->table->find(w);
+    if (a < 0 || b < 0) return false;
+    auto row = v->row(a);
+    return find(row.first, row.second, b) != row.second;
+}
+
+// Precondition: target is an id of this version
+// Postcondition: r holds a BFS from source that stopped once target was
+//                reached; returns target's distance or -1
+
+template <typename D, typename K>
+int VersionedGraph<D, K>::Reader::bfs(int source, int target, BfsResult &r) const
+{
+    r.begin(v->table->keys.size());
+    if (source < 0) return -1;
+    r.source = source;
+    r.visit(source, 0, -1);
+    for (size_t head = 0; head < r.order.size() && !r.reached(target); head++) {
+        int u = r.order[head];
+        auto row = v->row(u);
+        for (const int *p = row.first; p != row.second; p++) {
+            if (!r.reached(*p)) r.visit(*p, r.distance(u) + 1, u);
+        }
+    }
+    return r.distance(target);
+}
+
+template <typename D, typename K>
+bool VersionedGraph<D, K>::Reader::reachable(K u, K w) const
+{
+    static thread_local BfsResult r;
+    int target = v->table->find(w);
+    return target >= 0 && bfs(v->table->find(u), target, r) >= 0;
+}
+
+template <typename D, typename K>
+vector<K> VersionedGraph<D, K>::Reader::path(K u, K w) const
+{
+    static thread_local BfsResult r;
+    vector<K> keys;
+    int target = v->table->find(w);
+    if (target < 0 || bfs(v->table->find(u), target, r) < 0) return keys;
+    for (int id = target; id != -1; id = r.parent(id)) {
+        keys.push_back(v->table->keys[id]);
+    }
+    reverse(keys.begin(), keys.end());
+    return keys;
+}
+
+template <typename D, typename K>
+void VersionedGraph<D, K>::Reader::print_path(K u, K w) const
+{
+    vector<K> keys = path(u, w);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i > 0) cout << " -> ";
+        cout << keys[i];
+    }
+}
@@ -4,9 +4,30 @@
 #include <vector>
 #include <map>
 #include <queue>
+#include <deque>
 #include <string>
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string_view>
+#include <charconv>
+#include <sstream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <bit>
+#include <concepts>
+#include <limits>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <unordered_map>
+#include "thread_pool.h"
+#include "mapped_file.h"
 
 using namespace std;
 
@@ -17,8 +38,10 @@ struct Vertex
     K key; // Edge key
     D data; // Edge data
     vector<K> adj; // Adjacency list (stored as keys)
+    vector<double> weights; // weights[i] is the weight of edge adj[i]; edges past its end weigh 1
+    int id;        // Dense id (index into the graph's CSR arrays)
 
-    // BFS properties
+    // BFS properties (compatibility mode: written only by bfs() and dfs())
     bool visited;  // Not Visited?
     int distance; // Distance from source (-1 represents infinity)
     K pi;         // Predecessor key
@@ -27,11 +50,821 @@ struct Vertex
     int discovery_time;  
     int finish_time;
     // Constructor
-    Vertex(K k, D d) : key(k), data(d), visited(false), distance(-1), 
+    Vertex(K k, D d) : key(k), data(d), id(-1), visited(false), distance(-1), pi(),
                        discovery_time(-1), finish_time(-1) {}
-    Vertex() : visited(false), distance(-1), discovery_time(-1), finish_time(-1) {}
+    Vertex() : id(-1), visited(false), distance(-1), pi(), discovery_time(-1), finish_time(-1) {}
 };
 
+// Strips the spaces and tabs around one token of a text graph file
+inline string_view trim_token(string_view token)
+{
+    size_t first = token.find_first_not_of(" \t");
+    if (first == string_view::npos) return string_view();
+    return token.substr(first, token.find_last_not_of(" \t") - first + 1);
+}
+
+// Converts one token of a text graph file to a key, ignoring the spaces and
+// tabs around it; returns false if the token is empty or is not a whole K
+template <typename K>
+bool parse_key(string_view token, K &key)
+{
+    token = trim_token(token);
+    if (token.empty()) return false;
+    if constexpr (is_same_v<K, string>)
+    {
+        key = K(token);
+        return true;
+    }
+    else if constexpr (is_integral_v<K>)
+    {
+        auto [end, ec] = from_chars(token.data(), token.data() + token.size(), key);
+        return ec == errc() && end == token.data() + token.size();
+    }
+    else
+    {
+        istringstream in{string(token)};
+        return (in >> key) && (in >> ws).eof();
+    }
+}
+
+// Size and speed of one load_adjacency_list() call
+struct LoadStats
+{
+    size_t bytes = 0;
+    size_t vertices = 0; // Lines with a key
+    size_t edges = 0;    // Neighbor tokens
+    double seconds = 0;
+    size_t error_line = 0; // First malformed line (from 1) when the load failed, else 0
+
+    double mb_per_second() const { return seconds > 0 ? bytes / 1e6 / seconds : 0; }
+    double edges_per_second() const { return seconds > 0 ? edges / seconds : 0; }
+};
+
+// Memory held by one graph, from memory_usage()
+struct MemoryStats
+{
+    size_t vertices = 0;
+    size_t vertex_bytes = 0; // Vertex objects and the capacity of their adj and weight lists
+    size_t csr_bytes = 0;   // Owned CSR arrays, id tables and key index (mapped snapshot sections are not counted)
+    size_t index_bytes = 0; // Reachability index, if built
+
+    size_t total_bytes() const { return vertex_bytes + csr_bytes + index_bytes; }
+    double bytes_per_vertex() const { return vertices > 0 ? double(total_bytes()) / vertices : 0; }
+};
+
+// Counters of one traversal call (reachable(), bfs(), print_path(), ...),
+// recorded only when compiled with -DGRAPH_STATS. Work done on thread-pool
+// workers is added up by the calling thread.
+struct TraversalStats
+{
+    const char *call = "";       // Outermost Graph method of the call
+    size_t vertices_reset = 0;   // Per-vertex search state cleared before or after the search
+    size_t vertices_visited = 0;
+    size_t edges_scanned = 0;
+    size_t lookups = 0;          // Key lookups through get() and id_of()
+    size_t queue_peak = 0;       // Largest BFS frontier or DFS stack
+
+    // Wall time of each phase; the rest of total_seconds is spent writing
+    // results (into the vertices or to cout)
+    double reset_seconds = 0;
+    double lookup_seconds = 0;
+    double search_seconds = 0;
+    double total_seconds = 0;
+};
+
+#ifdef GRAPH_STATS
+// Counters of the call running on this thread
+inline TraversalStats &traversal_stats()
+{
+    static thread_local TraversalStats stats;
+    return stats;
+}
+
+// Adds the wall time of its scope to one phase of traversal_stats()
+class StatsPhase
+{
+public:
+    explicit StatsPhase(double &seconds) : seconds(seconds), start(chrono::steady_clock::now()) {}
+    ~StatsPhase() { seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count(); }
+
+private:
+    double &seconds;
+    chrono::steady_clock::time_point start;
+};
+
+// Scope of a public Graph method. Only the outermost one on a thread counts:
+// it clears the counters on entry and passes them to hook on exit.
+class StatsCall
+{
+public:
+    StatsCall(const char *name, const function<void(const TraversalStats &)> &hook)
+        : hook(hook), start(chrono::steady_clock::now())
+    {
+        if (depth()++ == 0) {
+            traversal_stats() = TraversalStats();
+            traversal_stats().call = name;
+        }
+    }
+    ~StatsCall()
+    {
+        if (--depth() > 0) return;
+        TraversalStats &stats = traversal_stats();
+        stats.total_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (hook) hook(stats);
+    }
+
+private:
+    static int &depth()
+    {
+        static thread_local int d = 0;
+        return d;
+    }
+
+    const function<void(const TraversalStats &)> &hook;
+    chrono::steady_clock::time_point start;
+};
+
+#define GRAPH_STATS_CALL(name) StatsCall graph_stats_call(name, stats_hook)
+#define GRAPH_STATS_PHASE(phase) StatsPhase graph_stats_phase(traversal_stats().phase##_seconds)
+#define GRAPH_STATS_ADD(counter, n) (traversal_stats().counter += (n))
+#define GRAPH_STATS_MAX(counter, n) (traversal_stats().counter = max<size_t>(traversal_stats().counter, (n)))
+#else
+// Without GRAPH_STATS the counters compile to nothing (arguments are not evaluated)
+#define GRAPH_STATS_CALL(name) ((void)0)
+#define GRAPH_STATS_PHASE(phase) ((void)0)
+#define GRAPH_STATS_ADD(counter, n) ((void)0)
+#define GRAPH_STATS_MAX(counter, n) ((void)0)
+#endif
+
+// Array of CSR data that either owns its elements or views memory owned
+// elsewhere, such as a memory-mapped snapshot
+template <typename T>
+class CsrArray
+{
+public:
+    CsrArray() = default;
+    CsrArray(const CsrArray &) = delete;
+    CsrArray &operator=(const CsrArray &) = delete;
+
+    const T &operator[](size_t i) const { return ptr[i]; }
+    size_t size() const { return len; }
+    const T *data() const { return ptr; }
+    const T *begin() const { return ptr; }
+    const T *end() const { return ptr + len; }
+    size_t owned_bytes() const { return owned.capacity() * sizeof(T); }
+
+    // Takes ownership of values
+    void set(vector<T> &&values)
+    {
+        owned = move(values);
+        ptr = owned.data();
+        len = owned.size();
+    }
+    // Views n elements at p without copying them; p must outlive the view
+    void view(const T *p, size_t n)
+    {
+        vector<T>().swap(owned);
+        ptr = p;
+        len = n;
+    }
+
+    // In-place updates. own() copies viewed elements into owned storage and
+    // must come first.
+    void own()
+    {
+        if (ptr != owned.data()) owned.assign(ptr, ptr + len);
+        ptr = owned.data();
+    }
+    T &at(size_t i) { return owned[i]; }
+    void push_back(const T &value)
+    {
+        owned.push_back(value);
+        ptr = owned.data();
+        len = owned.size();
+    }
+    void resize(size_t n)
+    {
+        owned.resize(n);
+        ptr = owned.data();
+        len = n;
+    }
+
+private:
+    vector<T> owned;
+    const T *ptr = nullptr;
+    size_t len = 0;
+};
+
+// Position inside one adjacency row: the slot index for plain rows, or the
+// byte offset and the last decoded id for varint rows
+struct RowCursor
+{
+    size_t pos;
+    int prev;
+};
+
+// Plain CSR rows: row u is nbr[off[u]..end[u])
+struct PlainRows
+{
+    const size_t *off;
+    const size_t *end;
+    const int *nbr;
+
+    struct Range
+    {
+        const int *first;
+        const int *last;
+        const int *begin() const { return first; }
+        const int *end() const { return last; }
+    };
+    Range row(int u) const { return {nbr + off[u], nbr + end[u]}; }
+    size_t degree(int u) const { return end[u] - off[u]; }
+
+    RowCursor start(int u) const { return {off[u], 0}; }
+    bool done(int u, const RowCursor &c) const { return c.pos >= end[u]; }
+    int next(RowCursor &c) const { return nbr[c.pos++]; }
+};
+
+// Read-only rows of ids, each stored as the zigzag LEB128 varint of its signed
+// difference from the previous id in the row (the first one from 0). Rows keep
+// the order they were encoded in; ids within 63 of the previous one take one
+// byte.
+class VarintRows
+{
+public:
+    // Decodes one row while iterating over it
+    class Iterator
+    {
+    public:
+        Iterator(const uint8_t *p, const uint8_t *last) : p(p), last(last) { decode(); }
+        int operator*() const { return value; }
+        bool operator!=(const Iterator &o) const { return p != o.p; }
+        Iterator &operator++()
+        {
+            p = q;
+            decode();
+            return *this;
+        }
+
+    private:
+        void decode()
+        {
+            q = p;
+            if (q != last) value += unzigzag(read(q));
+        }
+
+        const uint8_t *p;    // Current varint
+        const uint8_t *q;    // Next varint
+        const uint8_t *last;
+        int value = 0;
+    };
+
+    struct Range
+    {
+        const uint8_t *first;
+        const uint8_t *last;
+        Iterator begin() const { return Iterator(first, last); }
+        Iterator end() const { return Iterator(last, last); }
+    };
+
+    // Encodes row u as slots[begins[u]..row_ends[u]), in that order, for every
+    // u < n. Returns false (and keeps nothing) past 4 GB of rows.
+    bool encode(size_t n, const size_t *begins, const size_t *row_ends, const int *slots)
+    {
+        offsets.assign(n + 1, 0);
+        bytes.clear();
+        for (size_t u = 0; u < n; u++)
+        {
+            int prev = 0;
+            for (size_t e = begins[u]; e < row_ends[u]; e++)
+            {
+                int v = slots[e];
+                for (uint32_t delta = zigzag(v - prev);; delta >>= 7)
+                {
+                    if (delta < 0x80)
+                    {
+                        bytes.push_back(delta);
+                        break;
+                    }
+                    bytes.push_back((delta & 0x7F) | 0x80);
+                }
+                prev = v;
+            }
+            if (bytes.size() > UINT32_MAX)
+            {
+                clear();
+                return false;
+            }
+            offsets[u + 1] = bytes.size();
+        }
+        bytes.shrink_to_fit();
+        return true;
+    }
+
+    void clear()
+    {
+        vector<uint32_t>().swap(offsets);
+        vector<uint8_t>().swap(bytes);
+    }
+
+    Range row(int u) const { return {bytes.data() + offsets[u], bytes.data() + offsets[u + 1]}; }
+    size_t degree(int u) const // One varint per id, and each ends with a byte below 0x80
+    {
+        return count_if(bytes.begin() + offsets[u], bytes.begin() + offsets[u + 1], [](uint8_t b) { return b < 0x80; });
+    }
+
+    RowCursor start(int u) const { return {offsets[u], 0}; }
+    bool done(int u, const RowCursor &c) const { return c.pos >= offsets[u + 1]; }
+    int next(RowCursor &c) const
+    {
+        const uint8_t *p = bytes.data() + c.pos;
+        c.prev += unzigzag(read(p));
+        c.pos = p - bytes.data();
+        return c.prev;
+    }
+
+    size_t memory_bytes() const { return offsets.capacity() * sizeof(uint32_t) + bytes.capacity(); }
+
+private:
+    // Maps 0, -1, 1, -2, ... to 0, 1, 2, 3, ... so small steps either way stay small
+    static uint32_t zigzag(int d) { return (uint32_t(d) << 1) ^ uint32_t(d >> 31); }
+    static int unzigzag(uint32_t x) { return int(x >> 1) ^ -int(x & 1); }
+
+    static uint32_t read(const uint8_t *&p)
+    {
+        uint32_t x = 0;
+        for (int shift = 0;; shift += 7)
+        {
+            uint8_t b = *p++;
+            x |= uint32_t(b & 0x7F) << shift;
+            if (b < 0x80) return x;
+        }
+    }
+
+    vector<uint32_t> offsets; // Row u is bytes[offsets[u]..offsets[u + 1])
+    vector<uint8_t> bytes;
+};
+
+// Numbering of the dense ids chosen by Graph::reorder()
+enum class VertexOrder : uint32_t
+{
+    KEYS = 0, // Key order (the default)
+    BFS,      // Breadth-first discovery order, searches started in key order
+    RCM,      // Reverse Cuthill-McKee over the undirected graph
+    DEGREE    // Descending in + out degree, so the hubs share cache lines
+};
+
+// Adjacency size before and after Graph::compress(). Plain rows cost an
+// offset per vertex and an int per edge, forward and reverse.
+struct CompressionStats
+{
+    size_t edges = 0;
+    size_t plain_bytes = 0;
+    size_t compressed_bytes = 0;
+
+    double plain_bytes_per_edge() const { return edges > 0 ? double(plain_bytes) / edges : 0; }
+    double compressed_bytes_per_edge() const { return edges > 0 ? double(compressed_bytes) / edges : 0; }
+    double ratio() const { return compressed_bytes > 0 ? double(plain_bytes) / compressed_bytes : 0; }
+};
+
+// On-disk layout written by save_snapshot(): this header, then 8-byte aligned
+// sections. Integers use the byte order of the machine that wrote the file.
+struct SnapshotHeader
+{
+    enum Section
+    {
+        KEY_ORDER,     // int32[V]: ids sorted by key
+        KEY_OFFSETS,   // uint64[V + 1] into KEYS (string keys only)
+        KEYS,          // K[V], or the characters of all string keys
+        DATA_OFFSETS,  // uint64[V + 1] into DATA (string data only)
+        DATA,          // D[V], or the characters of all string data
+        OFFSETS,       // uint64[V + 1]
+        NEIGHBORS,     // int32[E]
+        REV_OFFSETS,   // uint64[V + 1]
+        REV_NEIGHBORS, // int32[E]
+        SECTIONS
+    };
+    static const uint32_t FORMAT_VERSION = 1;
+
+    char magic[8];          // "GRAPHSNP"
+    uint32_t format_version;
+    uint32_t key_kind;      // 0 for string keys, else sizeof(K)
+    uint32_t data_kind;     // 0 for string data, else sizeof(D)
+    uint32_t vertex_order;  // VertexOrder of the ids (0 for files before reorder())
+    uint64_t vertex_count;
+    uint64_t edge_count;
+    uint64_t section_offset[SECTIONS]; // From the start of the file
+    uint64_t section_bytes[SECTIONS];
+    uint64_t checksum;      // FNV-1a over every byte after the header
+};
+
+// FNV-1a hash used as the snapshot checksum; pass the previous value to continue it
+inline uint64_t snapshot_checksum(const void *p, size_t bytes, uint64_t h = 14695981039346656037ull)
+{
+    const unsigned char *c = static_cast<const unsigned char *>(p);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        h = (h ^ c[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+// Keys the hash index can hold: std::hash and operator== must exist for them
+template <typename K>
+concept HashableKey = requires(const K &a) {
+    { hash<K>()(a) } -> convertible_to<size_t>;
+    { a == a } -> convertible_to<bool>;
+};
+
+// Open-addressing hash table from keys to dense ids (linear probing with
+// backward-shift deletion). Keys are not copied: each slot holds an id and 32
+// bits of its key's hash, and the caller's key_of(id) confirms a match, so the
+// only copy of a key is the one in its vertex. Keys without std::hash (only
+// operator<, as for the vertices map) go in an ordered map instead.
+template <typename K>
+class KeyIndex
+{
+public:
+    // Returns the id of key, or -1
+    template <typename KeyOf>
+    int find(const K &key, KeyOf key_of) const
+    {
+        if constexpr (!HashableKey<K>)
+        {
+            auto it = ordered.find(key);
+            return it == ordered.end() ? -1 : it->second;
+        }
+        else
+        {
+            if (slots.empty()) return -1;
+            uint32_t h = hash_of(key);
+            for (size_t i = h & mask;; i = (i + 1) & mask)
+            {
+                const Slot &s = slots[i];
+                if (s.id < 0) return -1;
+                if (s.hash == h && key_of(s.id) == key) return s.id;
+            }
+        }
+    }
+
+    // Precondition: key is not in the index
+    void insert(const K &key, int id)
+    {
+        if constexpr (!HashableKey<K>)
+        {
+            ordered.emplace(key, id);
+        }
+        else
+        {
+            if ((count + 1) * 2 > slots.size()) grow(max<size_t>(16, slots.size() * 2));
+            place({hash_of(key), id});
+        }
+        count++;
+    }
+
+    // Returns false if key was not in the index
+    template <typename KeyOf>
+    bool erase(const K &key, KeyOf key_of)
+    {
+        if constexpr (!HashableKey<K>)
+        {
+            if (ordered.erase(key) == 0) return false;
+        }
+        else
+        {
+            if (slots.empty()) return false;
+            uint32_t h = hash_of(key);
+            size_t i = h & mask;
+            for (;; i = (i + 1) & mask)
+            {
+                if (slots[i].id < 0) return false;
+                if (slots[i].hash == h && key_of(slots[i].id) == key) break;
+            }
+
+            // Shift later entries of the probe run back so no lookup skips past a hole
+            for (size_t j = (i + 1) & mask; slots[j].id >= 0; j = (j + 1) & mask)
+            {
+                size_t home = slots[j].hash & mask;
+                if (((j - home) & mask) >= ((j - i) & mask))
+                {
+                    slots[i] = slots[j];
+                    i = j;
+                }
+            }
+            slots[i].id = -1;
+        }
+        count--;
+        return true;
+    }
+
+    // Renumbers every id after compaction; ids mapped to -1 must already be erased
+    void remap(const vector<int> &new_id)
+    {
+        for (auto &pair : ordered)
+        {
+            pair.second = new_id[pair.second];
+        }
+        for (Slot &s : slots)
+        {
+            if (s.id >= 0) s.id = new_id[s.id];
+        }
+    }
+
+    void clear(size_t expected = 0)
+    {
+        slots.clear();
+        ordered.clear();
+        count = 0;
+        if constexpr (HashableKey<K>) grow(max<size_t>(16, bit_ceil(expected * 2 + 1)));
+    }
+
+    size_t size() const { return count; }
+    size_t bytes() const // Map nodes counted as the entry plus three pointers and a color
+    {
+        return slots.capacity() * sizeof(Slot) + ordered.size() * (sizeof(pair<const K, int>) + 4 * sizeof(void *));
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t hash;
+        int id; // -1 for an empty slot
+    };
+
+    // std::hash may be the identity for integers, so mix it before using the low bits
+    static uint32_t hash_of(const K &key)
+    {
+        uint64_t x = hash<K>()(key) * 0x9E3779B97F4A7C15ull;
+        return uint32_t(x >> 32);
+    }
+
+    void place(Slot s)
+    {
+        size_t i = s.hash & mask;
+        while (slots[i].id >= 0) i = (i + 1) & mask;
+        slots[i] = s;
+    }
+
+    void grow(size_t size)
+    {
+        vector<Slot> old(size, Slot{0, -1});
+        old.swap(slots);
+        mask = size - 1;
+        for (const Slot &s : old)
+        {
+            if (s.id >= 0) place(s);
+        }
+    }
+
+    vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+    map<K, int> ordered; // Used instead of slots when K is not a HashableKey
+};
+
+// Per-query generation counter. An id belongs to the current query only if
+// its stamp equals epoch, so starting a query does not clear any arrays.
+struct EpochStamps
+{
+    unsigned epoch = 0;
+    vector<unsigned> stamp;
+
+    // Starts a new generation over n ids; stamps are only cleared on wraparound
+    void next(size_t n)
+    {
+        if (stamp.size() < n) stamp.resize(n, 0);
+        if (++epoch == 0)
+        {
+            GRAPH_STATS_ADD(vertices_reset, stamp.size());
+            fill(stamp.begin(), stamp.end(), 0);
+            epoch = 1;
+        }
+    }
+    bool current(int id) const { return stamp[id] == epoch; }
+    void mark(int id) { stamp[id] = epoch; }
+};
+
+// Result of one breadth-first search, indexed by dense vertex id.
+// Reusing one object across queries costs only the vertices each query reaches.
+struct BfsResult
+{
+    int source = -1;   // Source id (-1 if the source key was not found)
+    vector<int> order; // Reached ids in the order they were discovered
+
+    bool reached(int id) const { return visited.current(id); }
+    int distance(int id) const { return reached(id) ? dist[id] : -1; } // -1 represents infinity
+    int parent(int id) const { return reached(id) ? pred[id] : -1; }   // -1 for the source and unreached ids
+
+    // Starts a new query over n vertices
+    void begin(size_t n)
+    {
+        visited.next(n);
+        if (dist.size() < n)
+        {
+            dist.resize(n);
+            pred.resize(n);
+        }
+        order.clear();
+        source = -1;
+    }
+    void visit(int id, int d, int p)
+    {
+        mark(id, d, p);
+        order.push_back(id);
+    }
+    // Records id as reached without appending it to order
+    void mark(int id, int d, int p)
+    {
+        visited.mark(id);
+        dist[id] = d;
+        pred[id] = p;
+    }
+
+    EpochStamps visited;
+    vector<int> dist;
+    vector<int> pred;
+};
+
+// Result of one weighted shortest-path search, indexed by dense vertex id
+struct ShortestPaths
+{
+    int source = -1;   // Source id (-1 if the source key was not found)
+    vector<int> order; // Settled ids in order of distance (Dijkstra only)
+
+    bool reached(int id) const { return visited.current(id); }
+    double distance(int id) const { return reached(id) ? dist[id] : numeric_limits<double>::infinity(); }
+    int parent(int id) const { return reached(id) ? pred[id] : -1; } // -1 for the source and unreached ids
+
+    // Starts a new search over n vertices
+    void begin(size_t n)
+    {
+        visited.next(n);
+        if (dist.size() < n)
+        {
+            dist.resize(n);
+            pred.resize(n);
+        }
+        order.clear();
+        source = -1;
+    }
+    void set(int id, double d, int p)
+    {
+        visited.mark(id);
+        dist[id] = d;
+        pred[id] = p;
+    }
+
+    EpochStamps visited;
+    vector<double> dist;
+    vector<int> pred;
+};
+
+// Min-heap of (distance, id) with Arity children per node. The wide, shallow
+// tree keeps sift-down within a few cache lines; stale entries are skipped by
+// the caller instead of supporting decrease-key.
+template <unsigned Arity = 4>
+class DaryHeap
+{
+public:
+    bool empty() const { return items.empty(); }
+    size_t size() const { return items.size(); }
+    void clear() { items.clear(); }
+    const pair<double, int> &top() const { return items.front(); }
+
+    void push(double d, int id)
+    {
+        size_t i = items.size();
+        items.push_back({d, id});
+        while (i > 0)
+        {
+            size_t parent = (i - 1) / Arity;
+            if (items[parent].first <= d) break;
+            items[i] = items[parent];
+            i = parent;
+        }
+        items[i] = {d, id};
+    }
+
+    void pop()
+    {
+        pair<double, int> last = items.back();
+        items.pop_back();
+        if (items.empty()) return;
+
+        size_t i = 0;
+        for (;;)
+        {
+            size_t first = i * Arity + 1;
+            if (first >= items.size()) break;
+            size_t best = first;
+            size_t end = min(items.size(), first + Arity);
+            for (size_t c = first + 1; c < end; c++)
+            {
+                if (items[c].first < items[best].first) best = c;
+            }
+            if (last.first <= items[best].first) break;
+            items[i] = items[best];
+            i = best;
+        }
+        items[i] = last;
+    }
+
+private:
+    vector<pair<double, int>> items;
+};
+
+// Result of one depth-first search over the whole graph, indexed by dense vertex id
+struct DfsResult
+{
+    bool discovered(int id) const { return visited.current(id); }
+    int parent(int id) const { return discovered(id) ? pred[id] : -1; } // -1 for tree roots
+    int discovery_time(int id) const { return discovered(id) ? d_time[id] : -1; }
+    int finish_time(int id) const { return discovered(id) ? f_time[id] : -1; }
+
+    // Starts a new search over n vertices
+    void begin(size_t n)
+    {
+        visited.next(n);
+        if (pred.size() < n)
+        {
+            pred.resize(n);
+            d_time.resize(n);
+            f_time.resize(n);
+        }
+    }
+    void discover(int id, int p, int time)
+    {
+        visited.mark(id);
+        pred[id] = p;
+        d_time[id] = time;
+        f_time[id] = -1;
+    }
+
+    EpochStamps visited;
+    vector<int> pred;
+    vector<int> d_time;
+    vector<int> f_time;
+    vector<pair<int, RowCursor>> frames; // Explicit DFS stack of (id, next edge), reused across searches
+};
+
+// Strongly connected components from Graph::scc(), indexed by dense vertex id.
+// Tarjan's algorithm closes sink components first, so components are numbered
+// in reverse topological order: every edge between two components goes from
+// the higher component id to the lower one.
+struct SccResult
+{
+    int count = 0;         // Number of components
+    vector<int> component; // vertex id -> component id (-1 for removed vertices)
+};
+
+// Reachability index over the SCC condensation of a graph, indexed by component id.
+// Each component carries interval labels from two DFS passes over the DAG:
+// [low, post] rules out unreachable pairs, and the spanning-tree interval
+// [pre, post] of the first pass proves reachable ones.
+struct ReachabilityIndex
+{
+    static const int LABELS = 2;
+
+    bool built = false;
+    unsigned long version = 0; // Graph version the index was built for
+
+    int components = 0;
+    vector<int> component;  // vertex id -> component id
+    vector<size_t> dag_offsets; // Condensation DAG in CSR form
+    vector<int> dag_targets;
+
+    vector<int> pre;              // Spanning-tree preorder of the first pass
+    vector<int> post[LABELS];     // Postorder rank of each pass
+    vector<int> low[LABELS];      // Smallest postorder rank reachable in each pass
+};
+
+// One edge labelled by classify_all_edges()
+template <typename K>
+struct ClassifiedEdge
+{
+    K from;
+    K to;
+    string type; // "tree edge", "back edge", "forward edge" or "cross edge"
+};
+
+// One change passed to Graph::apply()
+template <typename D, typename K>
+struct GraphUpdate
+{
+    enum Kind
+    {
+        ADD_VERTEX,
+        REMOVE_VERTEX,
+        ADD_EDGE,
+        REMOVE_EDGE
+    };
+
+    Kind kind;
+    K u;    // The vertex, or the tail of the edge
+    K v{};  // Head of the edge (edge updates only)
+    D data{}; // Data of the new vertex (ADD_VERTEX only)
+    double weight = 1; // Weight of the new edge (ADD_EDGE only)
+};
 
 // Graph class template: <DataType, KeyType>
 template <typename D, typename K>
@@ -43,12 +876,34 @@ public:
 
     // Constructors
     Graph();
-    Graph(vector<K> keys, vector<D> data, vector<vector<K>> edges);
+    Graph(const vector<K> &keys, const vector<D> &data, const vector<vector<K>> &edges);
+    // Weighted graph: weights[i][j] is the weight of edge keys[i] -> edges[i][j]
+    Graph(const vector<K> &keys, const vector<D> &data, const vector<vector<K>> &edges,
+          const vector<vector<double>> &weights);
+
+    // Loaders for the "key:neighbor,neighbor" adjacency-list format, one vertex
+    // per line (e.g. graph_description.txt). Files are memory-mapped and parsed
+    // in parallel chunks straight into vertices. make_data gives each vertex
+    // its data (D() if empty) and may be called from several threads at once;
+    // progress(bytes_done, bytes_total) is called as chunks finish. Spaces
+    // and tabs around keys are ignored; blank lines and empty neighbor tokens
+    // are skipped. Return nullptr if the file cannot be opened or a key does
+    // not parse as a K (stats->error_line names the first such line).
+    static Graph *load_adjacency_list(const string &path, function<D(const K &)> make_data = nullptr,
+                                      LoadStats *stats = nullptr, function<void(size_t, size_t)> progress = nullptr);
+    static Graph *load_adjacency_list(istream &in, function<D(const K &)> make_data = nullptr,
+                                      LoadStats *stats = nullptr, function<void(size_t, size_t)> progress = nullptr);
+    static Graph *load_adjacency_list(const char *text, size_t size, function<D(const K &)> make_data = nullptr,
+                                      LoadStats *stats = nullptr, function<void(size_t, size_t)> progress = nullptr);
 
     // Destructor
     ~Graph();
 
-    // Required methods
+    // Required methods. bfs(), bfs_tree() and print_path() leave their
+    // search in the vertices' BFS properties (print_path() stops once v is
+    // found, so only the vertices reached by then are set); reachable()
+    // searches from both ends and leaves them alone. edge_class() classifies
+    // against the DFS forest, which does not depend on any earlier call.
     Vertex<D, K> *get(K key);
 
     bool reachable(K u, K v);
@@ -68,10 +923,487 @@ public:
     void bfs_tree(K s);
     
     K find_source();
+
+    // Read-only queries. Results are returned instead of being stored in the
+    // vertices, so several threads may run these on one shared graph.
+    // edge_class(), classify_all_edges(), scc(), same_component(),
+    // condensation() and the weighted queries fill a cache on first use under
+    // a lock, so they may share the graph too. On a compressed graph the
+    // components and weights first decompress it, which must not overlap any
+    // other query: call decompress() before sharing a compressed graph that
+    // will serve them.
+    BfsResult bfs_result(K s) const;
+    DfsResult dfs_result() const;
+
+    // Same queries writing into a caller-owned result that is reused across calls
+    void bfs_result(K s, BfsResult &r) const;
+    void dfs_result(DfsResult &r) const;
+
+    // Direction-optimizing BFS: switches to bottom-up steps (unvisited vertices
+    // search their incoming edges for a frontier parent) while the frontier is
+    // large. Same distances as bfs_result(); parents form a valid BFS tree.
+    BfsResult bfs_hybrid_result(K s) const;
+    void bfs_hybrid_result(K s, BfsResult &r) const;
+
+    // Shortest path by bidirectional BFS (forward edges from u, incoming edges
+    // from v) that stops when the frontiers meet; empty if v is unreachable
+    vector<K> bidirectional_path(K u, K v) const;
+
+    // Batched queries: one multi-source BFS answers up to 64 distinct sources,
+    // each vertex carrying a bitmask of the sources that reached it. Results are
+    // in the order of pairs; a pair with a missing key is unreachable (-1).
+    vector<bool> reachable_batch(const vector<pair<K, K>> &pairs) const;
+    vector<int> distance_batch(const vector<pair<K, K>> &pairs) const;
+
+    // Labels every edge (in adjacency order) from one cached DFS forest,
+    // using the same rules as edge_class()
+    vector<ClassifiedEdge<K>> classify_all_edges();
+
+    // edge_class() against a forest from dfs_result(), without the last bfs()
+    // (the forest does not depend on it); "no edge" only if u -> v is missing
+    string edge_class(K u, K v, const DfsResult &forest) const;
+
+    // Optional reachability index for mostly static graphs. While it matches
+    // the graph version, reachable() answers from labels without a traversal;
+    // after rebuild() it is stale and reachable() falls back to BFS.
+    void build_reachability_index();
+
+    // Strongly connected components, computed without recursion and cached
+    // until the graph changes, so same_component() is O(1) after the first
+    // call. condensation() returns the component DAG as a new graph: keys are
+    // component ids, data are the member keys in key order and edges are the
+    // distinct edges between components. The caller deletes it.
+    const SccResult &scc();
+    bool same_component(K u, K v);
+    Graph<vector<K>, int> *condensation();
+    bool has_reachability_index() const;
+    size_t reachability_index_bytes() const;
+
+    // Weighted shortest paths. Edge weights must be non-negative; an edge
+    // without one weighs 1, so an unweighted graph gives hop counts. Weights
+    // are not saved in snapshots.
+    // shortest_paths() runs Dijkstra with a 4-ary heap over the whole graph;
+    // shortest_path(), shortest_distance() and print_shortest_path() stop as
+    // soon as v is settled. delta_stepping() computes the same distances with
+    // buckets of width delta (0 picks the mean edge weight) whose edges are
+    // relaxed on the thread pool, for large graphs. set_weight() returns false
+    // if the edge is missing or the weight is negative.
+    bool set_weight(K u, K v, double weight);
+    double weight(K u, K v); // Infinity if there is no edge
+    ShortestPaths shortest_paths(K s);
+    ShortestPaths delta_stepping(K s, double delta = 0);
+    vector<K> shortest_path(K u, K v);
+    double shortest_distance(K u, K v);
+    void print_shortest_path(K u, K v);
+
+    // Dependency order. topological_sort() runs Kahn's algorithm (ties broken
+    // in key order) and returns true with every key in order, each after all
+    // of its predecessors; on a cycle it returns false with the keys of one
+    // cycle in cycle, each with an edge to the next and the last to the first.
+    // for_each_wavefront() calls fn(key) for every vertex once fn has returned
+    // for all of its predecessors, on threads workers (0 = get_threads())
+    // that steal ready vertices from each other and sleep while none is
+    // ready. It returns false and calls nothing if the graph has a cycle.
+    bool topological_sort(vector<K> &order, vector<K> &cycle) const;
+    bool for_each_wavefront(const function<void(const K &)> &fn, unsigned workers = 0);
+
+    // Read-only compressed adjacency. compress() compacts the graph and
+    // replaces the forward and reverse CSR rows with varint-delta rows (see
+    // VarintRows) that keep each row's order, so every search visits
+    // neighbors exactly as it did on the plain rows. Graphs
+    // whose rows would take over 4 GB stay plain (compressed_bytes is 0). bfs(),
+    // dfs(), bfs_tree(), print_path(), reachable(), edge_class() and the
+    // other unweighted queries decode the rows as they go (hybrid and
+    // parallel BFS fall back to the single-thread search). Updates, weights,
+    // components and snapshots first call decompress(), which restores plain
+    // rows unchanged.
+    CompressionStats compress();
+    void decompress();
+    bool is_compressed() const;
+
+    // Locality. reorder() renumbers the dense ids so that vertices searched
+    // together sit together in the CSR arrays: BFS and RCM follow the graph's
+    // structure, DEGREE packs the hubs at the front. Only ids change; every
+    // key-level result (get(), print_path(), bfs_tree(), dfs(), edge_class(),
+    // topological_sort(), ...) is the same in any order. compact(), rebuild()
+    // and snapshots keep the chosen order, and compressed rows are re-encoded
+    // in it with each row's neighbors in the same order (RCM usually shrinks
+    // them).
+    void reorder(VertexOrder order);
+    VertexOrder get_vertex_order() const;
+
+    // Incremented by every change to the CSR arrays
+    unsigned long get_version() const;
+
+    // Bytes held by the vertices, the CSR arrays and the index
+    MemoryStats memory_usage() const;
+
+    // Instrumentation (compiled with -DGRAPH_STATS only). last_stats() holds
+    // the counters of the last traversal call on this thread, and the hook,
+    // if set, receives them as each call returns. Without GRAPH_STATS,
+    // last_stats() is all zeros and the hook is never called.
+#ifdef GRAPH_STATS
+    static constexpr bool STATS_ENABLED = true;
+#else
+    static constexpr bool STATS_ENABLED = false;
+#endif
+    static TraversalStats last_stats();
+    void set_stats_hook(function<void(const TraversalStats &)> hook);
+
+    // Threads used by bfs_result() and everything built on it (0 = one per
+    // core, the default). Graphs with fewer than min_vertices vertices always
+    // take the single-thread path.
+    void set_threads(unsigned n, size_t min_vertices = PARALLEL_MIN_VERTICES);
+    unsigned get_threads() const;
+
+    // Updates applied in place to the adj lists, the CSR arrays and the
+    // reverse adjacency, without a rebuild(). Each returns false if it changed
+    // nothing (key already present or missing, duplicate or missing edge).
+    // A removed vertex leaves a tombstone id; compact() renumbers the ids and
+    // repacks the rows, and runs by itself once tombstones or moved rows
+    // waste too much space. Every change increments the version. Adj entries
+    // that named a key before add_vertex() created it become edges, as they
+    // would in a rebuild().
+    bool add_vertex(K key, D data = D());
+    bool remove_vertex(K key);
+    bool add_edge(K u, K v, double weight = 1);
+    bool remove_edge(K u, K v);
+
+    // Applies updates in order and returns how many changed the graph;
+    // compaction is only considered once, after the whole batch
+    size_t apply(const vector<GraphUpdate<D, K>> &updates);
+    void compact();
+
+    // Binary snapshots (string or trivially copyable keys and data).
+    // open_snapshot() maps the file and serves queries straight from the
+    // mapped pages; vertices are only materialized when get() or the
+    // compatibility bfs()/dfs() need them. Returns false / nullptr on failure,
+    // including a checksum mismatch when verify is set. Saving compacts the
+    // graph first if it has pending tombstones; a snapshot graph may be saved
+    // back to the file it was opened from.
+    bool save_snapshot(const string &path);
+    static Graph *open_snapshot(const string &path, bool verify = true);
+
+    // Dense-key policy for integral keys (off by default). While the keys span
+    // at most DENSE_KEY_SPREAD values per vertex, key -> id is a single array
+    // index instead of a hash lookup; sparser keys fall back to the hash index
+    // until the next rebuild() or compact().
+    void set_dense_keys(bool on) requires integral<K> && (!same_as<K, bool>);
+    bool has_dense_keys() const;
+
+    // Translation between keys and dense ids (-1 if key is not in the graph)
+    int id_of(K key) const;
+    K key_of(int id) const;
+
+    // Rebuilds the CSR arrays from vertices/adj. Must be called after
+    // editing the vertices map or an adj list directly.
+    void rebuild();
 private:
     // Helper methods
     void reset_bfs_state();
-    
+    void mark_all_bfs_touched();
+
+    vector<int> bfs_touched; // Ids whose BFS fields were written by the last bfs()
+
+    void dfs_visit_id(int u, int &time, DfsResult &r) const;
+    template <typename Rows>
+    void dfs_visit_rows(const Rows &out, int root, int &time, DfsResult &r) const;
+    void bfs_parallel(BfsResult &r, unsigned workers) const;
+    void for_ranges(size_t n, const function<void(size_t, size_t)> &fn) const;
+    void bfs_from(int src, int target, BfsResult &r) const;
+    int bidirectional_search(int source, int target, BfsResult &forward, BfsResult &backward) const;
+
+    // One distance_batch query: (source id, target id, index into the result)
+    struct BatchQuery
+    {
+        int source;
+        int target;
+        size_t index;
+    };
+    void distance_batch_group(const BatchQuery *queries, size_t count, vector<int> &result) const;
+
+    int strongly_connected(vector<int> &component) const;
+    bool index_reachable(int u, int v) const;
+    vector<vector<int>> component_edges(const vector<int> &component, int count) const;
+
+    // Weight of each slot of neighbors (empty while every edge weighs 1), built
+    // from the vertices' weights on first use after a change
+    vector<double> weight_cache;
+    bool weight_cache_valid = false;
+    unsigned long weight_cache_version = 0;
+    const vector<double> &csr_weights();
+    void dijkstra(int source, int target, ShortestPaths &r);
+    void erase_adj(Vertex<D, K> *v, const K &key);
+
+    // Components shared by scc() calls; valid while the graph version matches
+    SccResult scc_cache;
+    bool scc_cache_valid = false;
+    unsigned long scc_cache_version = 0;
+
+    const DfsResult &cached_dfs();
+    void record_bfs(const BfsResult &r);
+    bool has_edge_id(int u, int v) const;
+    string classify(int u, int v, const DfsResult &r) const;
+
+    bool is_live(int id) const;
+    template <typename F>
+    void for_each_id(F fn) const;
+
+    // DFS forest shared by edge_class() calls; valid while the graph version
+    // matches
+    DfsResult dfs_cache;
+    bool dfs_cache_valid = false;
+    unsigned long dfs_cache_version = 0;
+
+    // Held while cached_dfs(), scc() or csr_weights() fills its cache and
+    // while decompress() replaces the rows
+    mutable mutex cache_lock;
+    int bfs_source = -1; // Source id of the last bfs()
+
+    unsigned long version = 0;
+    ReachabilityIndex reach_index;
+
+    function<void(const TraversalStats &)> stats_hook;
+
+    // CSR (compressed sparse row) adjacency over dense ids 0..V-1.
+    // Ids follow key order, so id order matches iteration order of vertices
+    // (until add_vertex() appends a key out of order or reorder() picks
+    // another order, see ids_in_key_order).
+    vector<Vertex<D, K> *> id_to_vertex; // id -> vertex
+    CsrArray<size_t> offsets;            // out-edges of id i are neighbors[offsets[i]..ends[i])
+    CsrArray<size_t> ends;               // views offsets + 1 while the rows are packed
+    CsrArray<int> neighbors;             // neighbor ids, one contiguous array for all vertices
+
+    // Reverse CSR: incoming edges of id i are rev_neighbors[rev_offsets[i]..rev_ends[i])
+    CsrArray<size_t> rev_offsets;
+    CsrArray<size_t> rev_ends;
+    CsrArray<int> rev_neighbors;
+
+    // In-place updates. Once unpacked, each row has spare capacity up to
+    // limits[i]; a full row moves to the end of the array with twice the room,
+    // leaving its old slots as garbage until compact().
+    bool packed = true;
+    vector<size_t> limits;
+    vector<size_t> rev_limits;
+    size_t edge_count = 0;
+    size_t garbage = 0;    // Abandoned slots in neighbors and rev_neighbors
+    size_t tombstones = 0; // Ids of removed vertices (null in id_to_vertex)
+    // Adj keys that name no vertex -> keys of the vertices whose adj lists hold
+    // them (set by rebuild()), so add_vertex() can add those edges
+    map<K, vector<K>> dangling;
+    bool ids_in_key_order = true;
+    VertexOrder id_order = VertexOrder::KEYS;
+    vector<int> ordered_ids() const;
+    void renumber(const vector<int> &order);
+
+    // Key -> id for every live vertex (empty while serving a snapshot, which
+    // searches its mapped key order instead)
+    KeyIndex<K> key_index;
+    void index_keys();
+    int index_find(const K &key) const;
+
+    // Integral keys under the dense-key policy: dense_ids[key - dense_lo] is the
+    // id of key (-1 for a gap); used only while dense_active
+    static const size_t DENSE_KEY_SPREAD = 4;
+    static constexpr bool DENSE_KEY_TYPE = is_integral_v<K> && !is_same_v<K, bool>;
+    bool dense_keys = false;
+    bool dense_active = false;
+    K dense_lo{};
+    vector<int> dense_ids;
+    void index_dense_keys();
+    void dense_insert(const K &key, int id);
+    static size_t dense_offset(K key, K lo);
+
+    void set_csr(vector<size_t> &&off, vector<int> &&nbr);
+
+    // Compressed rows (see compress()); the plain arrays are empty meanwhile
+    bool compressed = false;
+    VarintRows packed_out;
+    VarintRows packed_in;
+
+    // Calls fn(out, in) with the forward and reverse rows in whichever form
+    // they are stored, so one generic body serves both
+    template <typename F>
+    decltype(auto) with_rows(F fn) const;
+    void unpack();
+    bool update(const GraphUpdate<D, K> &u);
+    void compact_if_sparse();
+    void row_insert(CsrArray<size_t> &begins, CsrArray<size_t> &row_ends, vector<size_t> &row_limits,
+                    CsrArray<int> &slots, int row, int value);
+    bool row_erase(CsrArray<size_t> &begins, CsrArray<size_t> &row_ends, CsrArray<int> &slots, int row, int value);
+
+    // Mapped snapshot behind the CSR arrays (null for graphs built in memory).
+    // id_to_vertex[id] stays null until vertex_at(id) materializes the vertex.
+    unique_ptr<MappedFile> snapshot;
+    const SnapshotHeader *snapshot_header = nullptr;
+
+    Vertex<D, K> *vertex_at(int id);
+    const char *snapshot_section(int section) const;
+    K snapshot_key(int id) const;
+    D snapshot_data(int id) const;
+    int snapshot_find(const K &key) const;
+
+    // Heuristic thresholds for bfs_hybrid_result (Beamer et al.)
+    static const int HYBRID_ALPHA = 14; // go bottom-up when frontier edges > unexplored edges / ALPHA
+    static const int HYBRID_BETA = 24;  // go top-down when frontier vertices < V / BETA
+
+    // Parallel BFS settings
+    static const size_t PARALLEL_MIN_VERTICES = 1 << 16; // Default size before bfs_result() goes parallel
+    static const size_t PARALLEL_MIN_FRONTIER = 256;     // Smaller levels are expanded on one thread
+    unsigned threads = 0;
+    size_t parallel_min_vertices = PARALLEL_MIN_VERTICES;
+};
+
+// Rows ROWS * b .. ROWS * b + ROWS - 1 of a GraphVersion: row i is
+// targets[offsets[i]..offsets[i + 1]). Blocks are immutable once published
+// and shared by every version that did not change them.
+struct AdjacencyBlock
+{
+    static const int ROWS = 64;
+    uint32_t offsets[ROWS + 1] = {};
+    vector<int> targets;
+};
+
+// Keys and data of a GraphVersion by dense id; removed ids stay as dead entries
+template <typename D, typename K>
+struct VertexTable
+{
+    vector<K> keys;
+    vector<D> data;
+    vector<bool> live;
+    KeyIndex<K> index;
+
+    int find(const K &key) const
+    {
+        return index.find(key, [this](int id) -> const K & { return keys[id]; });
+    }
+};
+
+// One immutable state of a VersionedGraph
+template <typename D, typename K>
+struct GraphVersion
+{
+    unsigned long number = 0;
+    const VertexTable<D, K> *table = nullptr;
+    vector<const AdjacencyBlock *> blocks; // blocks[b] holds the rows of ids ROWS * b onwards
+    size_t edge_count = 0;
+
+    pair<const int *, const int *> row(int id) const
+    {
+        const AdjacencyBlock *b = blocks[id / AdjacencyBlock::ROWS];
+        int i = id % AdjacencyBlock::ROWS;
+        return {b->targets.data() + b->offsets[i], b->targets.data() + b->offsets[i + 1]};
+    }
+};
+
+// Versioned handle for reading a graph while it is being updated (RCU style).
+// Readers pin() the current version without taking a lock and see it
+// unchanged for as long as they hold the Reader. apply() builds the next
+// version by copying only the adjacency blocks (AdjacencyBlock::ROWS rows
+// each) its updates touch, publishes it with one atomic store and retires the
+// old version. Epoch-based reclamation frees a retired version and its
+// replaced blocks once every reader pinned before it was published has let go;
+// a long-lived Reader therefore holds back every version retired after it.
+// Writers are serialized. Adding or removing vertices also copies the key
+// table, and removing one scans every row for its in-edges, so batch those.
+// Edges are unweighted (GraphUpdate::weight is ignored).
+template <typename D, typename K>
+class VersionedGraph
+{
+public:
+    // Pinned version; all queries see the graph as it was when pinned
+    class Reader
+    {
+    public:
+        Reader(Reader &&other) noexcept;
+        Reader &operator=(Reader &&) = delete;
+        ~Reader();
+
+        unsigned long version() const;
+        size_t vertex_count() const;
+        size_t edge_count() const;
+        bool contains(K key) const;
+        const D *data(K key) const; // nullptr if key is not a vertex
+        vector<K> neighbors(K key) const;
+        bool has_edge(K u, K v) const;
+
+        // Same answers as Graph::reachable() and Graph::print_path(); path()
+        // returns the keys of a shortest path (empty if v is unreachable)
+        bool reachable(K u, K v) const;
+        vector<K> path(K u, K v) const;
+        void print_path(K u, K v) const;
+
+    private:
+        friend class VersionedGraph;
+        Reader(const VersionedGraph *owner, atomic<uint64_t> *slot, const GraphVersion<D, K> *v)
+            : owner(owner), slot(slot), v(v) {}
+        int bfs(int source, int target, BfsResult &r) const;
+
+        const VersionedGraph *owner;
+        atomic<uint64_t> *slot;
+        const GraphVersion<D, K> *v;
+    };
+
+    VersionedGraph();
+    explicit VersionedGraph(const Graph<D, K> &G); // Copies the vertices and edges of G
+    // Precondition: no Reader is still pinned
+    ~VersionedGraph();
+
+    VersionedGraph(const VersionedGraph &) = delete;
+    VersionedGraph &operator=(const VersionedGraph &) = delete;
+
+    // Lock-free unless READER_SLOTS readers are pinned at once, in which case
+    // it sleeps until one of them finishes
+    Reader pin() const;
+
+    // Applies updates in order as one new version and returns how many changed
+    // the graph (same rules as Graph::apply()); nothing is published if none did
+    size_t apply(const vector<GraphUpdate<D, K>> &updates);
+    bool add_vertex(K key, D data = D());
+    bool remove_vertex(K key);
+    bool add_edge(K u, K v);
+    bool remove_edge(K u, K v);
+
+    unsigned long version() const;
+    size_t retired_versions() const; // Versions waiting for readers to finish
+
+    static const size_t READER_SLOTS = 1024;
+
+private:
+    static const uint64_t IDLE = UINT64_MAX;
+
+    // Epoch a pinned reader announced (IDLE for a free slot), one per cache line
+    struct alignas(64) ReaderSlot
+    {
+        atomic<uint64_t> epoch{IDLE};
+    };
+
+    // A version and whatever it alone referenced, freed once no reader can see it
+    struct Retired
+    {
+        uint64_t epoch; // Global epoch right after the next version was published
+        const GraphVersion<D, K> *version;
+        const VertexTable<D, K> *table; // Null if the next version kept the table
+        vector<const AdjacencyBlock *> blocks;
+    };
+
+    void reclaim();
+    static void row_insert(AdjacencyBlock &b, int i, int value);
+    static size_t row_erase(AdjacencyBlock &b, int i, int value, bool all);
+
+    atomic<const GraphVersion<D, K> *> current{nullptr};
+    mutable atomic<uint64_t> global_epoch{0};
+    mutable ReaderSlot slots[READER_SLOTS];
+
+    // pin() sleeps here while every slot is taken; released readers only
+    // take the lock when someone is waiting
+    mutable mutex slot_mutex;
+    mutable condition_variable slot_freed;
+    mutable atomic<int> slot_waiters{0};
+    atomic<uint64_t> *claim_slot() const;
+
+    mutable mutex writer; // Held by apply(); guards retired
+    vector<Retired> retired;
 };
 
 #endif // GRAPH_H
@@ -0,0 +1,66 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+    explicit MappedFile(const string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+        {
+            length = st.st_size;
+            if (length == 0)
+            {
+                opened = true; // Nothing to map
+            }
+            else
+            {
+                void *p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    bytes = static_cast<const char *>(p);
+                    opened = true;
+                }
+            }
+        }
+        close(fd); // The mapping stays valid after the descriptor is closed
+    }
+
+    ~MappedFile()
+    {
+        if (bytes != nullptr) munmap(const_cast<char *>(bytes), length);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Hint that the file will be read front to back (enables readahead)
+    void advise_sequential() const
+    {
+        if (bytes != nullptr) madvise(const_cast<char *>(bytes), length, MADV_SEQUENTIAL);
+    }
+
+    bool is_open() const { return opened; }
+    const char *data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+    bool opened = false;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,318 @@
+//
+//  query.cpp
+//  Batch query engine: loads a graph once and answers a stream of queries.
+//
+//  Usage: ./query GRAPH [QUERIES] [--threads N] [--out FILE]
+//  GRAPH is a "key:neighbor,neighbor" adjacency list (see graph_description.txt).
+//  QUERIES is a file with one query per line, or stdin if omitted or "-":
+//      reachable U V
+//      path U V
+//      edge_class U V
+//      bfs_tree S
+//  Blank lines and lines starting with '#' are skipped. Queries with the same
+//  source share one BFS; the groups run on a thread pool. Results are written
+//  one line per query in input order (to stdout or FILE); throughput and
+//  latency histograms are printed to stderr at the end.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include "graph.cpp"
+
+using namespace std;
+
+// 1. Queries
+
+enum QueryKind
+{
+    REACHABLE,
+    PATH,
+    EDGE_CLASS,
+    BFS_TREE,
+    INVALID,
+    KINDS
+};
+
+const char *const KIND_NAMES[KINDS] = {"reachable", "path", "edge_class", "bfs_tree", "invalid"};
+
+struct Query
+{
+    QueryKind kind = INVALID;
+    string u;       // Source (or the tail of the edge)
+    string v;       // Target (unused by bfs_tree)
+    string text;    // The input line, echoed with the result
+    string result;
+    double micros = 0; // From the start of its group to its answer
+};
+
+// Returns false for a blank line or a comment
+bool parse_query(const string &line, Query &q)
+{
+    istringstream in(line);
+    string kind;
+    if (!(in >> kind) || kind[0] == '#') return false;
+
+    q.text = line;
+    if (kind == "reachable") q.kind = REACHABLE;
+    else if (kind == "path") q.kind = PATH;
+    else if (kind == "edge_class") q.kind = EDGE_CLASS;
+    else if (kind == "bfs_tree") q.kind = BFS_TREE;
+
+    int args = q.kind == BFS_TREE ? 1 : 2;
+    string extra;
+    if (!(in >> q.u) || (args == 2 && !(in >> q.v)) || (in >> extra)) q.kind = INVALID;
+    if (q.kind == INVALID) q.result = "invalid query";
+    return true;
+}
+
+// 2. Answers
+
+typedef Graph<string, string> StringGraph;
+
+// Writes the keys of the BFS tree path from r's source to target, in the
+// print_path() format (empty if target was not reached)
+string path_text(const StringGraph &G, const BfsResult &r, int target)
+{
+    if (target < 0 || !r.reached(target)) return "";
+    vector<int> path;
+    for (int id = target; id != -1; id = r.parent(id))
+    {
+        path.push_back(id);
+    }
+    string text;
+    for (size_t i = path.size(); i-- > 0;)
+    {
+        text += G.key_of(path[i]);
+        if (i > 0) text += " -> ";
+    }
+    return text;
+}
+
+// bfs_tree() output with its levels separated by " | " to keep one line per query
+string tree_text(const StringGraph &G, const BfsResult &r)
+{
+    string text;
+    for (size_t i = 0; i < r.order.size(); i++)
+    {
+        if (i > 0) text += r.distance(r.order[i]) != r.distance(r.order[i - 1]) ? " | " : " ";
+        text += G.key_of(r.order[i]);
+    }
+    return text;
+}
+
+// Answers every query of one source. A lone reachable query uses the
+// bidirectional search of reachable(); otherwise one full BFS serves them all,
+// and a path is the BFS tree path print_path() would print.
+void answer_group(StringGraph &G, const DfsResult &forest, vector<Query> &queries, const vector<size_t> &group)
+{
+    static thread_local BfsResult r;
+    auto start = chrono::steady_clock::now();
+    auto done = [&](Query &q) {
+        q.micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    };
+
+    Query &first = queries[group[0]];
+    if (group.size() == 1 && first.kind == REACHABLE)
+    {
+        first.result = G.reachable(first.u, first.v) ? "true" : "false";
+        done(first);
+        return;
+    }
+
+    bool searched = false;
+    string tree; // Shared by the bfs_tree queries of the group
+    for (size_t i : group)
+    {
+        Query &q = queries[i];
+        if (q.kind == EDGE_CLASS)
+        {
+            q.result = G.edge_class(q.u, q.v, forest);
+            done(q);
+            continue;
+        }
+        if (!searched)
+        {
+            G.bfs_result(q.u, r);
+            searched = true;
+        }
+        int target = q.kind == BFS_TREE ? -1 : G.id_of(q.v);
+        if (q.kind == REACHABLE) q.result = target >= 0 && r.reached(target) ? "true" : "false";
+        else if (q.kind == PATH) q.result = path_text(G, r, target);
+        else
+        {
+            if (tree.empty()) tree = tree_text(G, r);
+            q.result = tree;
+        }
+        done(q);
+    }
+}
+
+// 3. Latency histograms
+
+// Counts of latencies in power-of-two buckets of microseconds
+struct Histogram
+{
+    static const int BUCKETS = 24; // Bucket b holds [2^(b-1), 2^b) us; bucket 0 is under 1 us
+    size_t count[BUCKETS] = {};
+    size_t total = 0;
+    double sum = 0;
+    double max = 0;
+
+    void add(double micros)
+    {
+        int b = 0;
+        while (b + 1 < BUCKETS && micros >= double(uint64_t(1) << b)) b++;
+        count[b]++;
+        total++;
+        sum += micros;
+        max = std::max(max, micros);
+    }
+
+    void print(ostream &out, const string &name) const
+    {
+        if (total == 0) return;
+        out << name << ": " << total << " queries, mean " << sum / total << " us, max " << max << " us" << endl;
+        size_t widest = *max_element(count, count + BUCKETS);
+        for (int b = 0; b < BUCKETS; b++)
+        {
+            if (count[b] == 0) continue;
+            string range = b == 0 ? "< 1 us" : "< " + to_string(uint64_t(1) << b) + " us";
+            out << "  " << range << string(12 - min<size_t>(11, range.size()), ' ') << string(1 + count[b] * 40 / widest, '#')
+                << " " << count[b] << endl;
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    vector<string> paths;
+    unsigned threads = max(1u, thread::hardware_concurrency());
+    string out_path;
+    bool bad_usage = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            string_view n = argv[++i];
+            int value = 0;
+            auto [end, ec] = from_chars(n.data(), n.data() + n.size(), value);
+            bad_usage = bad_usage || ec != errc() || end != n.data() + n.size();
+            threads = max(1, value);
+        }
+        else if (arg == "--out" && i + 1 < argc) out_path = argv[++i];
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+        {
+            cerr << "Unknown option " << arg << endl;
+            return 1;
+        }
+        else paths.push_back(arg);
+    }
+    if (bad_usage || paths.empty() || paths.size() > 2)
+    {
+        cerr << "Usage: " << argv[0] << " GRAPH [QUERIES] [--threads N] [--out FILE]" << endl;
+        return 1;
+    }
+
+    auto load_start = chrono::steady_clock::now();
+    LoadStats load;
+    StringGraph *G = StringGraph::load_adjacency_list(paths[0], nullptr, &load);
+    if (G == nullptr)
+    {
+        if (load.error_line > 0) cerr << paths[0] << ":" << load.error_line << ": malformed line" << endl;
+        else cerr << "Cannot open " << paths[0] << endl;
+        return 1;
+    }
+    G->set_threads(1); // Parallelism is across groups; keeps every BFS tree deterministic
+    double load_seconds = chrono::duration<double>(chrono::steady_clock::now() - load_start).count();
+
+    ifstream file;
+    if (paths.size() == 2 && paths[1] != "-")
+    {
+        file.open(paths[1]);
+        if (!file)
+        {
+            cerr << "Cannot open " << paths[1] << endl;
+            delete G;
+            return 1;
+        }
+    }
+    istream &in = file.is_open() ? file : cin;
+
+    ofstream out_file;
+    if (!out_path.empty())
+    {
+        out_file.open(out_path);
+        if (!out_file)
+        {
+            cerr << "Cannot open " << out_path << endl;
+            delete G;
+            return 1;
+        }
+    }
+    vector<Query> queries;
+    string line;
+    while (getline(in, line))
+    {
+        Query q;
+        if (parse_query(line, q)) queries.push_back(move(q));
+    }
+
+    auto run_start = chrono::steady_clock::now();
+
+    // Group by source, largest groups first so the pool finishes evenly.
+    // edge_class needs no BFS but shares the groups of its tail vertex.
+    unordered_map<string, size_t> group_of;
+    vector<vector<size_t>> groups;
+    bool any_edge_class = false;
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        if (queries[i].kind == INVALID) continue;
+        any_edge_class = any_edge_class || queries[i].kind == EDGE_CLASS;
+        auto it = group_of.try_emplace(queries[i].u, groups.size()).first;
+        if (it->second == groups.size()) groups.emplace_back();
+        groups[it->second].push_back(i);
+    }
+    sort(groups.begin(), groups.end(), [](const vector<size_t> &a, const vector<size_t> &b) { return a.size() > b.size(); });
+
+    // One DFS forest answers every edge_class query
+    DfsResult forest;
+    if (any_edge_class) G->dfs_result(forest);
+
+    ThreadPool pool(threads - 1); // The calling thread works too
+    pool.run(groups.size(), [&](size_t g) { answer_group(*G, forest, queries, groups[g]); });
+    double run_seconds = chrono::duration<double>(chrono::steady_clock::now() - run_start).count();
+
+    ostream &out = out_file.is_open() ? out_file : cout;
+    for (const Query &q : queries)
+    {
+        out << q.text << "\t" << q.result << "\n";
+    }
+    out.flush();
+
+    Histogram all;
+    Histogram by_kind[KINDS];
+    for (const Query &q : queries)
+    {
+        if (q.kind == INVALID) continue;
+        all.add(q.micros);
+        by_kind[q.kind].add(q.micros);
+    }
+    cerr << "Loaded " << G->vertices.size() << " vertices in " << load_seconds << " s; " << queries.size() << " queries in "
+         << groups.size() << " source groups on " << threads << " threads" << endl;
+    cerr << "Throughput: " << (run_seconds > 0 ? queries.size() / run_seconds : 0) << " queries/s (" << run_seconds
+         << " s)" << endl;
+    all.print(cerr, "all");
+    for (int k = 0; k < INVALID; k++)
+    {
+        by_kind[k].print(cerr, KIND_NAMES[k]);
+    }
+    delete G;
+    return 0;
+}
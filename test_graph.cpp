@@ -36,6 +36,56 @@ Graph<int, string> *generate_graph()
     return G;
 }
 
+// 2. Generate a larger <int, int> graph for comparing traversal engines.
+// Vertex 0 is a hub pointing at every tenth vertex, and every vertex has
+// `degree` pseudo-random out-edges, so BFS frontiers grow quickly.
+Graph<int, int> *generate_int_graph(int n, int degree, unsigned seed)
+{
+    vector<int> keys(n);
+    vector<int> data(n);
+    vector<vector<int>> edges(n);
+    for (int i = 0; i < n; i++)
+    {
+        keys[i] = i;
+        data[i] = i * 10;
+        for (int j = 0; j < degree; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            edges[i].push_back((seed >> 8) % n);
+        }
+        if (i % 10 == 0)
+        {
+            edges[0].push_back(i);
+        }
+    }
+    return new Graph<int, int>(keys, data, edges);
+}
+
+// Checks that r has the same distances as bfs_result(s) and that every
+// parent is a real edge one level closer to the source
+bool same_bfs_levels(Graph<int, int> *G, int s, BfsResult &r)
+{
+    BfsResult expected = G->bfs_result(s);
+    for (int id = 0; id < (int)G->vertices.size(); id++)
+    {
+        if (r.distance(id) != expected.distance(id))
+        {
+            return false;
+        }
+        int p = r.parent(id);
+        if (id == r.source || p == -1)
+        {
+            continue;
+        }
+        vector<int> &adj = G->get(G->key_of(p))->adj;
+        if (r.distance(p) + 1 != r.distance(id) || find(adj.begin(), adj.end(), G->key_of(id)) == adj.end())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 void test_get(Graph<int, string> *G)
 {
     try
@@ -187,12 +237,88 @@ void test_edge_class_custom()
         
         // Test all classifications...
         delete G;
+
+        // Without any bfs(): the other searches leave edge_class() working
+        // and bfs_tree()/print_path() leave the BFS properties set
+        Graph<int, string> *H = new Graph<int, string>(k, d, e);
+        if (!H->reachable("A", "E") || H->edge_class("A", "B") != "tree edge")
+        {
+            cout << "Incorrect edge_class after reachable." << endl;
+        }
+        stringstream buffer;
+        streambuf *prevbuf = cout.rdbuf(buffer.rdbuf());
+        H->bfs_tree("A");
+        cout.rdbuf(prevbuf);
+        if (H->edge_class("C", "A") != "back edge" || H->get("D")->distance != 2 || H->get("D")->pi != "B" ||
+            H->find_source() != "A")
+        {
+            cout << "Incorrect edge_class or BFS properties after bfs_tree." << endl;
+        }
+        prevbuf = cout.rdbuf(buffer.rdbuf());
+        H->print_path("B", "E");
+        cout.rdbuf(prevbuf);
+        if (H->edge_class("C", "D") != "cross edge" || H->get("E")->distance != 2 || H->get("A")->distance != -1)
+        {
+            cout << "Incorrect edge_class or BFS properties after print_path." << endl;
+        }
+        delete H;
     }
     catch (exception &e) {
         cerr << "Error testing edge class : " << e.what() << endl;
     }
 }
 
+void test_classify_all_edges()
+{
+    try
+    {
+        vector<string> k = {"A", "B", "C", "D", "E"};
+        vector<int> d = {1, 2, 3, 4, 5};
+        vector<vector<string>> e = {{"B", "C"}, {"D"}, {"D", "A"}, {"E"}, {"B"}};
+        Graph<int, string> *G = new Graph<int, string>(k, d, e);
+        G->bfs("A");
+
+        vector<ClassifiedEdge<string>> all = G->classify_all_edges();
+        if (all.size() != 7)
+        {
+            cout << "classify_all_edges returned " << all.size() << " edges instead of 7." << endl;
+        }
+        for (ClassifiedEdge<string> &edge : all)
+        {
+            string single = G->edge_class(edge.from, edge.to);
+            if (edge.type != single)
+            {
+                cout << "classify_all_edges labelled (" << edge.from << ", " << edge.to << ") as "
+                     << edge.type << " but edge_class returned " << single << endl;
+            }
+        }
+        if (G->edge_class("C", "A") != "back edge" || G->edge_class("C", "D") != "cross edge")
+        {
+            cout << "Incorrect edge_class from the cached DFS forest." << endl;
+        }
+
+        // The same labels from a caller-owned forest, without a bfs() first
+        Graph<int, string> *H = new Graph<int, string>(k, d, e);
+        DfsResult forest = H->dfs_result();
+        for (ClassifiedEdge<string> &edge : all)
+        {
+            if (H->edge_class(edge.from, edge.to, forest) != edge.type)
+            {
+                cout << "edge_class with a forest labelled (" << edge.from << ", " << edge.to << ") differently." << endl;
+            }
+        }
+        if (H->edge_class("A", "E", forest) != "no edge" || H->edge_class("A", "Z", forest) != "no edge")
+        {
+            cout << "Incorrect edge_class with a forest for a missing edge." << endl;
+        }
+        delete H;
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing classify all edges : " << e.what() << endl;
+    }
+}
 
 void test_bfs_tree(Graph<int, string> *G)
 {
@@ -232,6 +358,1613 @@ void test_bfs_tree(Graph<int, string> *G)
     }
 }
 
+void test_query_results(Graph<int, string> *G)
+{
+    try
+    {
+        G->bfs("B");
+        BfsResult r = G->bfs_result("A");
+
+        string vertices[5] = {"A", "B", "C", "D", "E"};
+        int distances[5] = {0, 1, 1, 2, -1};
+        for (int i = 0; i < 5; i++)
+        {
+            if (r.distance(G->id_of(vertices[i])) != distances[i])
+            {
+                cout << "Incorrect bfs_result. Vertex " << vertices[i]
+                     << " should have distance " << distances[i] << " from source \"A\"" << endl;
+            }
+        }
+        if (G->key_of(r.parent(G->id_of("D"))) != "B")
+        {
+            cout << "Incorrect bfs_result parent for \"D\". Expected \"B\"" << endl;
+        }
+        // The query must not touch the vertex fields of the earlier bfs("B")
+        if (G->get("B")->distance != 0 || G->get("A")->distance != 3)
+        {
+            cout << "bfs_result modified the BFS fields stored in the vertices." << endl;
+        }
+
+        // A reused result must forget what the previous query reached
+        BfsResult reused;
+        G->bfs_result("A", reused);
+        G->bfs_result("D", reused);
+        if (reused.distance(G->id_of("B")) != 3 || reused.distance(G->id_of("E")) != -1)
+        {
+            cout << "Incorrect reused bfs_result from source \"D\"." << endl;
+        }
+        G->bfs_result("E", reused);
+        if (reused.order.size() != 1 || reused.reached(G->id_of("A")))
+        {
+            cout << "Reused bfs_result kept vertices reached by an earlier query." << endl;
+        }
+
+        // dfs() copies dfs_result() into the vertices
+        DfsResult d = G->dfs_result();
+        G->dfs("A");
+        for (int i = 0; i < 5; i++)
+        {
+            Vertex<int, string> *v = G->get(vertices[i]);
+            int id = G->id_of(vertices[i]);
+            if (v->discovery_time != d.discovery_time(id) || v->finish_time != d.finish_time(id))
+            {
+                cout << "Incorrect dfs_result times for vertex " << vertices[i] << endl;
+            }
+        }
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing query results : " << e.what() << endl;
+    }
+}
+
+void test_bfs_hybrid()
+{
+    try
+    {
+        Graph<int, int> *G = generate_int_graph(2000, 4, 7);
+        BfsResult r;
+        int sources[3] = {0, 17, 1999};
+        for (int i = 0; i < 3; i++)
+        {
+            G->bfs_hybrid_result(sources[i], r);
+            if (!same_bfs_levels(G, sources[i], r))
+            {
+                cout << "Incorrect bfs_hybrid_result from source " << sources[i] << endl;
+            }
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing hybrid bfs : " << e.what() << endl;
+    }
+}
+
+void test_parallel_bfs()
+{
+    try
+    {
+        Graph<int, int> *G = generate_int_graph(5000, 6, 11);
+        G->set_threads(1);
+        BfsResult expected = G->bfs_result(0);
+        stringstream expected_tree;
+        streambuf *prevbuf = cout.rdbuf(expected_tree.rdbuf());
+        G->bfs_tree(0);
+        cout.rdbuf(prevbuf);
+
+        // Force the parallel path on this small graph
+        G->set_threads(4, 0);
+        BfsResult r = G->bfs_result(0);
+        if (r.order != expected.order)
+        {
+            cout << "Parallel bfs_result visited vertices in a different order than the sequential bfs." << endl;
+        }
+        for (int id = 0; id < 5000; id++)
+        {
+            if (r.distance(id) != expected.distance(id) || r.parent(id) != expected.parent(id))
+            {
+                cout << "Incorrect parallel bfs_result for vertex " << id << endl;
+                break;
+            }
+        }
+
+        stringstream tree;
+        prevbuf = cout.rdbuf(tree.rdbuf());
+        G->bfs_tree(0);
+        cout.rdbuf(prevbuf);
+        if (tree.str() != expected_tree.str())
+        {
+            cout << "Parallel bfs_tree output differs from the sequential bfs_tree." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing parallel bfs : " << e.what() << endl;
+    }
+}
+
+void test_reachable_batch(Graph<int, string> *G)
+{
+    try
+    {
+        vector<pair<string, string>> pairs = {
+            {"A", "B"}, {"A", "E"}, {"B", "A"}, {"E", "E"}, {"Z", "A"}, {"C", "D"}};
+        vector<bool> expected = {true, false, true, true, false, true};
+        vector<bool> reach = G->reachable_batch(pairs);
+        for (size_t i = 0; i < pairs.size(); i++)
+        {
+            if (reach[i] != expected[i])
+            {
+                cout << "Incorrect reachable_batch result for (" << pairs[i].first << ", "
+                     << pairs[i].second << ")" << endl;
+            }
+        }
+
+        // More than 64 sources, checked against one bfs_result per source
+        Graph<int, int> *H = generate_int_graph(3000, 2, 5);
+        vector<pair<int, int>> queries;
+        for (int i = 0; i < 500; i++)
+        {
+            queries.push_back({(i * 37) % 150, (i * 101) % 3000});
+        }
+        vector<int> distances = H->distance_batch(queries);
+        for (size_t i = 0; i < queries.size(); i++)
+        {
+            BfsResult r = H->bfs_result(queries[i].first);
+            if (distances[i] != r.distance(queries[i].second))
+            {
+                cout << "Incorrect distance_batch result for (" << queries[i].first << ", "
+                     << queries[i].second << ")" << endl;
+                break;
+            }
+        }
+        delete H;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing reachable batch : " << e.what() << endl;
+    }
+}
+
+void test_reachability_index()
+{
+    try
+    {
+        // Sparse graph so that many pairs are unreachable
+        Graph<int, int> *G = generate_int_graph(1500, 1, 3);
+        vector<pair<int, int>> pairs;
+        for (int i = 0; i < 3000; i++)
+        {
+            pairs.push_back({(i * 7919) % 1500, (i * 104729) % 1500});
+        }
+        vector<bool> expected = G->reachable_batch(pairs);
+
+        G->build_reachability_index();
+        if (!G->has_reachability_index() || G->reachability_index_bytes() == 0)
+        {
+            cout << "Reachability index was not built." << endl;
+        }
+        for (size_t i = 0; i < pairs.size(); i++)
+        {
+            if (G->reachable(pairs[i].first, pairs[i].second) != expected[i])
+            {
+                cout << "Incorrect indexed reachable(" << pairs[i].first << ", " << pairs[i].second << ")" << endl;
+                break;
+            }
+        }
+
+        // A change to the graph makes the index stale; reachable() must fall back to BFS
+        G->get(1499)->adj.push_back(0);
+        G->rebuild();
+        if (G->has_reachability_index())
+        {
+            cout << "Reachability index still in use after rebuild." << endl;
+        }
+        if (!G->reachable(1499, 0))
+        {
+            cout << "Incorrect reachable() after the index went stale." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing reachability index : " << e.what() << endl;
+    }
+}
+
+void test_deep_dfs()
+{
+    try
+    {
+        // A 300000-vertex chain would overflow the call stack of a recursive DFS
+        int n = 300000;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i;
+            data[i] = i;
+            if (i + 1 < n) edges[i].push_back(i + 1);
+        }
+        Graph<int, int> *G = new Graph<int, int>(keys, data, edges);
+
+        DfsResult r = G->dfs_result();
+        if (r.discovery_time(0) != 1 || r.finish_time(0) != 2 * n ||
+            r.discovery_time(n - 1) != n || r.finish_time(n - 1) != n + 1 || r.parent(n - 1) != n - 2)
+        {
+            cout << "Incorrect dfs_result on a deep chain." << endl;
+        }
+
+        G->dfs(0);
+        if (G->get(n - 1)->pi != n - 2 || G->get(n / 2)->discovery_time != n / 2 + 1)
+        {
+            cout << "Incorrect dfs on a deep chain." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing deep dfs : " << e.what() << endl;
+    }
+}
+
+void test_bidirectional_path()
+{
+    try
+    {
+        Graph<int, int> *G = generate_int_graph(2000, 2, 13);
+        for (int i = 0; i < 300; i++)
+        {
+            int u = (i * 131) % 2000;
+            int v = (i * 577 + 3) % 2000;
+            BfsResult r = G->bfs_result(u);
+            vector<int> path = G->bidirectional_path(u, v);
+
+            if ((int)path.size() - 1 != r.distance(v) && !(path.empty() && r.distance(v) == -1))
+            {
+                cout << "Incorrect bidirectional_path length from " << u << " to " << v << endl;
+                break;
+            }
+            bool valid = path.empty() || (path.front() == u && path.back() == v);
+            for (size_t j = 1; j < path.size() && valid; j++)
+            {
+                vector<int> &adj = G->get(path[j - 1])->adj;
+                valid = find(adj.begin(), adj.end(), path[j]) != adj.end();
+            }
+            if (!valid)
+            {
+                cout << "bidirectional_path from " << u << " to " << v << " is not a path of the graph." << endl;
+                break;
+            }
+            if (G->reachable(u, v) != (r.distance(v) != -1))
+            {
+                cout << "Incorrect reachable(" << u << ", " << v << ")" << endl;
+                break;
+            }
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing bidirectional path : " << e.what() << endl;
+    }
+}
+
+void test_load_adjacency_list()
+{
+    try
+    {
+        LoadStats stats;
+        size_t reported = 0;
+        Graph<string, string> *G = Graph<string, string>::load_adjacency_list(
+            "graph_description.txt", [](const string &key) { return key + " data"; }, &stats,
+            [&](size_t done, size_t) { reported = done; });
+        if (G == nullptr)
+        {
+            cout << "Could not load graph_description.txt" << endl;
+            return;
+        }
+        if (G->get("S") == nullptr || G->get("S")->data != "S data" || G->vertices.size() != 8)
+        {
+            cout << "Incorrect vertices after load_adjacency_list." << endl;
+        }
+        if (stats.vertices != 8 || stats.edges != 10 || stats.bytes == 0 || reported != stats.bytes)
+        {
+            cout << "Incorrect LoadStats after load_adjacency_list." << endl;
+        }
+
+        stringstream buffer;
+        streambuf *prevbuf = cout.rdbuf(buffer.rdbuf());
+        G->bfs_tree("T");
+        cout.rdbuf(prevbuf);
+        if (buffer.str() != "T\nS U W\nR Y X\nV")
+        {
+            cout << "Incorrect bfs tree after load_adjacency_list. Got :\n" << buffer.str() << endl;
+        }
+        delete G;
+
+        // Streams, int keys, Windows line endings and vertices without neighbors
+        stringstream in("1:2,3\r\n2:3\r\n3:\r\n4\r\n");
+        Graph<int, int> *H = Graph<int, int>::load_adjacency_list(in);
+        if (H->vertices.size() != 4 || !H->reachable(1, 3) || H->reachable(3, 1) || H->get(3)->adj.size() != 0)
+        {
+            cout << "Incorrect graph loaded from a stream." << endl;
+        }
+        delete H;
+
+        // Spaces around keys are ignored; a token that is not a whole key fails the load at its line
+        stringstream spaced("1: 2, 3\n 2 :3,\n\n3\t:\n");
+        Graph<int, int> *T = Graph<int, int>::load_adjacency_list(spaced);
+        if (T == nullptr || T->vertices.size() != 3 || T->get(1)->adj != vector<int>{2, 3} || !T->reachable(2, 3))
+        {
+            cout << "Incorrect graph loaded with spaces around keys." << endl;
+        }
+        delete T;
+        const char *malformed[] = {"1:2\n2:3\n3:4x\n", "1:2\n2:3\n3:4 5\n", "1:2\n2:3\nx:4\n", "1:2\n2:3\n:4\n"};
+        for (const char *text : malformed)
+        {
+            stats = LoadStats();
+            if (Graph<int, int>::load_adjacency_list(text, strlen(text), nullptr, &stats) != nullptr || stats.error_line != 3)
+            {
+                cout << "load_adjacency_list should fail at line 3 of a malformed file, got " << stats.error_line << endl;
+            }
+        }
+        string long_text;
+        for (int k = 0; k < 200000; k++)
+        {
+            long_text += to_string(k) + ":" + to_string(k + 1) + "\n";
+        }
+        long_text += "oops\n";
+        stats = LoadStats();
+        if (Graph<int, int>::load_adjacency_list(long_text.data(), long_text.size(), nullptr, &stats) != nullptr ||
+            stats.error_line != 200001)
+        {
+            cout << "load_adjacency_list should count lines across chunks, got " << stats.error_line << endl;
+        }
+
+        if (Graph<int, int>::load_adjacency_list("no_such_file.txt") != nullptr)
+        {
+            cout << "load_adjacency_list should return nullptr for a missing file." << endl;
+        }
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing load adjacency list : " << e.what() << endl;
+    }
+}
+
+void test_snapshot()
+{
+    try
+    {
+        Graph<string, string> *G = Graph<string, string>::load_adjacency_list(
+            "graph_description.txt", [](const string &key) { return key + " data"; });
+        if (G == nullptr || !G->save_snapshot("test_snapshot.bin"))
+        {
+            cout << "Could not save snapshot." << endl;
+            delete G;
+            return;
+        }
+        delete G;
+
+        Graph<string, string> *S = Graph<string, string>::open_snapshot("test_snapshot.bin");
+        if (S == nullptr)
+        {
+            cout << "Could not open snapshot." << endl;
+            return;
+        }
+        if (!S->reachable("T", "V") || S->reachable("V", "T") || S->get("Q") != nullptr)
+        {
+            cout << "Incorrect reachable on snapshot." << endl;
+        }
+        stringstream buffer;
+        streambuf *prevbuf = cout.rdbuf(buffer.rdbuf());
+        S->bfs_tree("T");
+        cout.rdbuf(prevbuf);
+        if (buffer.str() != "T\nS U W\nR Y X\nV")
+        {
+            cout << "Incorrect bfs tree on snapshot. Got :\n" << buffer.str() << endl;
+        }
+        if (S->get("S") == nullptr || S->get("S")->data != "S data" || S->get("S")->adj.size() != 1)
+        {
+            cout << "Incorrect vertex materialized from snapshot." << endl;
+        }
+
+        // A snapshot of a snapshot holds the same graph
+        if (!S->save_snapshot("test_snapshot2.bin"))
+        {
+            cout << "Could not save snapshot of a snapshot." << endl;
+        }
+        delete S;
+        Graph<string, string> *S2 = Graph<string, string>::open_snapshot("test_snapshot2.bin");
+        if (S2 == nullptr || !S2->reachable("R", "V") || S2->get("W")->data != "W data")
+        {
+            cout << "Incorrect snapshot of a snapshot." << endl;
+        }
+
+        // Saving back over the mapped file leaves the open graph readable
+        if (S2 == nullptr || !S2->save_snapshot("test_snapshot2.bin") || !S2->reachable("T", "V") ||
+            S2->get("X") == nullptr || S2->get("X")->data != "X data")
+        {
+            cout << "Incorrect snapshot saved over its own file." << endl;
+        }
+        delete S2;
+        S2 = Graph<string, string>::open_snapshot("test_snapshot2.bin");
+        if (S2 == nullptr || !S2->reachable("R", "V") || S2->get("X")->data != "X data")
+        {
+            cout << "Incorrect snapshot reopened after saving over its own file." << endl;
+        }
+        delete S2;
+
+        // Int keys: same distances as the graph that was saved
+        Graph<int, int> *H = generate_int_graph(3000, 4, 5);
+        H->save_snapshot("test_snapshot.bin");
+        Graph<int, int> *HS = Graph<int, int>::open_snapshot("test_snapshot.bin");
+        int sources[] = {0, 17, 1500, 2999};
+        for (int s : sources)
+        {
+            BfsResult expected = H->bfs_result(s);
+            BfsResult got = HS->bfs_result(s);
+            for (int id = 0; id < 3000; id++)
+            {
+                if (expected.distance(id) != got.distance(id))
+                {
+                    cout << "Incorrect distances on int snapshot from " << s << endl;
+                    break;
+                }
+            }
+        }
+        delete HS;
+        delete H;
+
+        // A flipped byte fails the checksum
+        {
+            fstream f("test_snapshot.bin", ios::in | ios::out | ios::binary);
+            f.seekp(-1, ios::end);
+            char c;
+            f.read(&c, 1);
+            c ^= 1;
+            f.seekp(-1, ios::end);
+            f.write(&c, 1);
+        }
+        if (Graph<int, int>::open_snapshot("test_snapshot.bin") != nullptr ||
+            Graph<string, int>::open_snapshot("test_snapshot2.bin") != nullptr)
+        {
+            cout << "open_snapshot should reject a corrupt or mismatched file." << endl;
+        }
+
+        // Without the checksum, truncated files and out-of-range offsets or ids are still rejected
+        Graph<string, string> *C = Graph<string, string>::load_adjacency_list("graph_description.txt");
+        C->save_snapshot("test_snapshot.bin");
+        delete C;
+        ifstream saved("test_snapshot.bin", ios::binary);
+        string bytes((istreambuf_iterator<char>(saved)), istreambuf_iterator<char>());
+        SnapshotHeader header;
+        memcpy(&header, bytes.data(), sizeof(header));
+        auto opens_with = [&](string file) {
+            ofstream("test_snapshot2.bin", ios::binary | ios::trunc) << file;
+            Graph<string, string> *B = Graph<string, string>::open_snapshot("test_snapshot2.bin", false);
+            delete B;
+            return B != nullptr;
+        };
+        auto patched = [&](int section, size_t index, auto value) {
+            string file = bytes;
+            memcpy(&file[header.section_offset[section] + index * sizeof(value)], &value, sizeof(value));
+            return file;
+        };
+        if (!opens_with(bytes) || opens_with(bytes.substr(0, header.section_offset[SnapshotHeader::DATA] + 1)) ||
+            opens_with(patched(SnapshotHeader::KEY_OFFSETS, header.vertex_count, uint64_t(1) << 40)) ||
+            opens_with(patched(SnapshotHeader::KEY_OFFSETS, 2, uint64_t(0))) ||
+            opens_with(patched(SnapshotHeader::KEY_ORDER, 0, int(header.vertex_count))) ||
+            opens_with(patched(SnapshotHeader::NEIGHBORS, 0, -1)))
+        {
+            cout << "open_snapshot should reject out-of-bounds sections without verify." << endl;
+        }
+        remove("test_snapshot.bin");
+        remove("test_snapshot2.bin");
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing snapshot : " << e.what() << endl;
+    }
+}
+
+void test_dynamic_updates()
+{
+    try
+    {
+        Graph<int, string> *G = generate_graph();
+        unsigned long version = G->get_version();
+        if (!G->add_edge("E", "A") || G->add_edge("E", "A") || G->add_edge("E", "Z") || !G->reachable("E", "D"))
+        {
+            cout << "Incorrect add_edge." << endl;
+        }
+        if (!G->add_vertex("F", 60) || G->add_vertex("F", 70) || !G->add_edge("D", "F") || !G->reachable("A", "F"))
+        {
+            cout << "Incorrect add_vertex." << endl;
+        }
+        if (!G->remove_edge("B", "D") || G->remove_edge("B", "D") || G->reachable("A", "F"))
+        {
+            cout << "Incorrect remove_edge." << endl;
+        }
+        if (!G->remove_vertex("C") || G->remove_vertex("C") || G->get("C") != nullptr ||
+            G->get("A")->adj != vector<string>{"B"} || G->reachable("D", "A"))
+        {
+            cout << "Incorrect remove_vertex." << endl;
+        }
+        if (G->get_version() <= version)
+        {
+            cout << "Updates should increment the version." << endl;
+        }
+        delete G;
+
+        // Adj entries naming a key before add_vertex() become edges, as in a rebuild()
+        vector<vector<string>> dangling_edges = {{"B", "X", "C", "X"}, {"X"}, {}, {}, {}};
+        Graph<int, string> *P = new Graph<int, string>({"A", "B", "C", "D", "E"}, {1, 2, 3, 4, 5}, dangling_edges);
+        if (P->reachable("A", "X") || !P->add_vertex("X", 6) || P->add_edge("A", "X", 5) || !P->add_edge("X", "D") ||
+            !P->reachable("B", "D"))
+        {
+            cout << "Incorrect add_vertex for a key named by adj lists." << endl;
+        }
+        auto tree_of = [](Graph<int, string> *H, const string &s) {
+            stringstream buffer;
+            streambuf *prevbuf = cout.rdbuf(buffer.rdbuf());
+            H->bfs_tree(s);
+            cout.rdbuf(prevbuf);
+            return buffer.str();
+        };
+        string in_place = tree_of(P, "A") + tree_of(P, "B") + tree_of(P, "D");
+        double in_place_weight = P->weight("A", "X");
+        P->remove_vertex("E"); // Leaves a tombstone so the comparison below is not trivially equal
+        P->rebuild();
+        if (tree_of(P, "A") + tree_of(P, "B") + tree_of(P, "D") != in_place || P->weight("A", "X") != in_place_weight || in_place_weight != 1 ||
+            P->get("A")->adj.size() != 4)
+        {
+            cout << "Incorrect add_vertex for a key named by adj lists: differs from a rebuild()." << endl;
+        }
+        delete P;
+
+        // A long stream of updates must leave the same graph as building it from scratch
+        Graph<int, int> *D = generate_int_graph(600, 3, 21);
+        unsigned seed = 5;
+        auto next = [&](int n) {
+            seed = seed * 1103515245 + 12345;
+            return (int)((seed >> 8) % n);
+        };
+        int new_key = 600;
+        vector<GraphUpdate<int, int>> batch;
+        for (int i = 0; i < 4000; i++)
+        {
+            int kind = next(20);
+            GraphUpdate<int, int> u{GraphUpdate<int, int>::ADD_EDGE, next(new_key), next(new_key)};
+            if (kind < 6)
+            {
+                u.kind = GraphUpdate<int, int>::REMOVE_EDGE;
+                Vertex<int, int> *v = D->get(u.u);
+                if (v != nullptr && !v->adj.empty()) u.v = v->adj[next(v->adj.size())];
+            }
+            else if (kind == 6)
+            {
+                u = {GraphUpdate<int, int>::ADD_VERTEX, next(2) ? new_key++ : -next(100), 0, 7};
+            }
+            else if (kind == 7)
+            {
+                u.kind = GraphUpdate<int, int>::REMOVE_VERTEX;
+            }
+
+            // Half of the stream goes through apply() in batches
+            if (i < 2000)
+            {
+                D->apply({u});
+            }
+            else
+            {
+                batch.push_back(u);
+                if (batch.size() == 50)
+                {
+                    D->apply(batch);
+                    batch.clear();
+                }
+            }
+        }
+
+        vector<int> keys, data;
+        vector<vector<int>> edges;
+        for (auto &pair : D->vertices)
+        {
+            keys.push_back(pair.first);
+            data.push_back(pair.second->data);
+            edges.push_back(pair.second->adj);
+        }
+        Graph<int, int> *E = new Graph<int, int>(keys, data, edges);
+
+        for (int i = 0; i < 20; i++)
+        {
+            int s = keys[next(keys.size())];
+            BfsResult a = D->bfs_result(s);
+            BfsResult b = E->bfs_result(s);
+            BfsResult h = D->bfs_hybrid_result(s);
+            for (int k : keys)
+            {
+                int expected = b.distance(E->id_of(k));
+                if (a.distance(D->id_of(k)) != expected || h.distance(D->id_of(k)) != expected)
+                {
+                    cout << "Incorrect distances after updates from " << s << endl;
+                    i = 20;
+                    break;
+                }
+            }
+        }
+
+        vector<ClassifiedEdge<int>> x = D->classify_all_edges();
+        vector<ClassifiedEdge<int>> y = E->classify_all_edges();
+        bool same = x.size() == y.size();
+        for (size_t i = 0; same && i < x.size(); i++)
+        {
+            same = x[i].from == y[i].from && x[i].to == y[i].to && x[i].type == y[i].type;
+        }
+        if (!same)
+        {
+            cout << "Incorrect edge classes after updates." << endl;
+        }
+
+        D->compact();
+        if (D->bfs_result(keys[0]).order.size() != E->bfs_result(keys[0]).order.size())
+        {
+            cout << "Incorrect search after compact." << endl;
+        }
+        delete D;
+        delete E;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing dynamic updates : " << e.what() << endl;
+    }
+}
+
+void test_memory_usage()
+{
+    try
+    {
+        Graph<int, int> *G = generate_int_graph(20000, 4, 3);
+        MemoryStats before = G->memory_usage();
+        if (before.vertices != 20000 || before.vertex_bytes < 20000 * (sizeof(Vertex<int, int>) + 4 * sizeof(int)) ||
+            before.csr_bytes < 2 * 80000 * sizeof(int) || before.bytes_per_vertex() <= 0)
+        {
+            cout << "Incorrect memory usage of a new graph." << endl;
+        }
+
+        // A stream of updates frees the vertices it removes
+        for (int round = 0; round < 5; round++)
+        {
+            for (int k = 0; k < 2000; k++) G->remove_vertex(k);
+            for (int k = 0; k < 2000; k++) G->add_vertex(k, k);
+        }
+        MemoryStats after = G->memory_usage();
+        if (after.vertices != 20000 || after.vertex_bytes > before.vertex_bytes)
+        {
+            cout << "Incorrect memory usage after updates: " << after.vertex_bytes << " vertex bytes, "
+                 << before.vertex_bytes << " before." << endl;
+        }
+
+        // Vertices created by the caller are still freed by the graph
+        G->vertices[-1] = new Vertex<int, int>(-1, 0);
+        G->rebuild();
+        delete G;
+
+        // A load large enough for several chunks; the graph owns the vertices
+        // every chunk made, so they can be removed and added again
+        string text;
+        for (int k = 0; k < 100000; k++)
+        {
+            text += to_string(k) + ":" + to_string((k + 1) % 100000) + "," + to_string((k + 7) % 100000) + "\n";
+        }
+        Graph<int, int> *L = Graph<int, int>::load_adjacency_list(text.data(), text.size());
+        MemoryStats loaded = L->memory_usage();
+        for (int k = 0; k < 5000; k++) L->remove_vertex(k);
+        for (int k = 0; k < 5000; k++) L->add_vertex(k, k);
+        if (text.size() <= (1 << 20) || loaded.vertices != 100000 || loaded.vertex_bytes < 100000 * sizeof(Vertex<int, int>) ||
+            L->memory_usage().vertices != loaded.vertices || !L->reachable(5000, 99999))
+        {
+            cout << "Incorrect memory usage of a graph loaded in chunks." << endl;
+        }
+        delete L;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing memory usage : " << e.what() << endl;
+    }
+}
+
+void test_key_index()
+{
+    try
+    {
+        // String keys through the hash index, including removals that shift probe runs
+        int n = 3000;
+        vector<string> keys(n);
+        vector<int> data(n);
+        vector<vector<string>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = "k" + to_string(i * 37 % n);
+            data[i] = i;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            edges[i] = {keys[(i + 1) % n], keys[(i * 7) % n], "missing"};
+        }
+        Graph<int, string> *G = new Graph<int, string>(keys, data, edges);
+
+        for (int i = 0; i < n; i += 3)
+        {
+            G->remove_vertex(keys[i]);
+        }
+        bool correct = G->get("missing") == nullptr && G->id_of("missing") == -1;
+        for (int i = 0; i < n && correct; i++)
+        {
+            Vertex<int, string> *v = G->get(keys[i]);
+            correct = i % 3 == 0 ? v == nullptr && G->id_of(keys[i]) == -1
+                                 : v != nullptr && v->data == i && G->key_of(G->id_of(keys[i])) == keys[i];
+        }
+        if (!correct || G->get(keys[1])->adj.size() != 3 || !G->reachable(keys[1], keys[2]))
+        {
+            cout << "Incorrect key lookups after removals." << endl;
+        }
+
+        for (int i = 0; i < n; i += 3)
+        {
+            G->add_vertex(keys[i], -i);
+        }
+        if (G->get(keys[0]) == nullptr || G->get(keys[3])->data != -3 || G->vertices.size() != (size_t)n)
+        {
+            cout << "Incorrect key lookups after adding vertices back." << endl;
+        }
+        delete G;
+
+        // Keys without std::hash only need operator<, as before the index
+        typedef pair<int, int> Cell;
+        static_assert(!HashableKey<Cell>);
+        vector<Cell> cells;
+        vector<vector<Cell>> cell_edges;
+        for (int i = 0; i < 100; i++)
+        {
+            cells.push_back({i / 10, i % 10});
+            cell_edges.push_back({{(i + 1) % 100 / 10, (i + 1) % 10}, {-1, -1}});
+        }
+        Graph<int, Cell> *P = new Graph<int, Cell>(cells, vector<int>(100), cell_edges);
+        P->remove_vertex({5, 0});
+        P->add_vertex({5, 0}, 7);
+        P->add_edge({4, 9}, {5, 0});
+        P->add_edge({5, 0}, {5, 1});
+        P->compact();
+        if (P->get({-1, -1}) != nullptr || P->id_of({5, 0}) < 0 || P->get({5, 0})->data != 7 ||
+            P->key_of(P->id_of({3, 4})) != Cell(3, 4) || !P->reachable({0, 0}, {9, 9}) || P->shortest_distance({4, 8}, {5, 1}) != 3)
+        {
+            cout << "Incorrect key lookups without a hash." << endl;
+        }
+        delete P;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing key index : " << e.what() << endl;
+    }
+}
+
+void test_dense_keys()
+{
+    try
+    {
+        // Same answers with and without the dense-key policy
+        Graph<int, int> *G = generate_int_graph(3000, 4, 9);
+        Graph<int, int> *D = generate_int_graph(3000, 4, 9);
+        D->set_dense_keys(true);
+        if (!D->has_dense_keys() || G->has_dense_keys())
+        {
+            cout << "Incorrect dense-key policy state." << endl;
+        }
+
+        vector<pair<int, int>> pairs;
+        for (int i = 0; i < 500; i++)
+        {
+            pairs.push_back({i * 13 % 3000, i * 101 % 3003}); // Some targets are missing
+        }
+        DfsResult gd = G->dfs_result();
+        DfsResult dd = D->dfs_result();
+        bool same = G->distance_batch(pairs) == D->distance_batch(pairs);
+        for (int s = 0; s < 3000 && same; s += 97)
+        {
+            BfsResult a = G->bfs_result(s);
+            BfsResult b = D->bfs_result(s);
+            same = a.order == b.order && gd.finish_time(s) == dd.finish_time(s) &&
+                   G->bidirectional_path(s, 2999) == D->bidirectional_path(s, 2999);
+        }
+        stringstream gout, dout;
+        streambuf *prevbuf = cout.rdbuf(gout.rdbuf());
+        G->bfs_tree(5);
+        cout.rdbuf(dout.rdbuf());
+        D->bfs_tree(5);
+        cout.rdbuf(prevbuf);
+        if (!same || gout.str() != dout.str())
+        {
+            cout << "Incorrect results with dense keys." << endl;
+        }
+
+        // Keys far outside the range fall back to the hash index until compacted
+        D->add_vertex(3000, 1);
+        if (!D->has_dense_keys() || D->get(3000) == nullptr || D->get(3001) != nullptr)
+        {
+            cout << "Incorrect dense keys after add_vertex." << endl;
+        }
+        D->add_vertex(1000000, 1);
+        if (D->has_dense_keys() || D->get(1000000) == nullptr || D->get(2999) == nullptr)
+        {
+            cout << "Incorrect fallback from dense keys." << endl;
+        }
+        D->remove_vertex(1000000);
+        D->compact();
+        if (!D->has_dense_keys() || D->get(1000000) != nullptr || D->get(3000) == nullptr)
+        {
+            cout << "Incorrect dense keys after compact." << endl;
+        }
+        delete G;
+        delete D;
+
+        // Negative keys
+        Graph<int, int> *N = new Graph<int, int>({-5, -1, 0, 4}, {1, 2, 3, 4}, {{-1}, {4}, {}, {-5}});
+        N->set_dense_keys(true);
+        if (!N->has_dense_keys() || N->get(-5)->data != 1 || N->get(-6) != nullptr || N->get(5) != nullptr ||
+            !N->reachable(-5, 4) || N->reachable(0, -5))
+        {
+            cout << "Incorrect dense keys with negative keys." << endl;
+        }
+        delete N;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing dense keys : " << e.what() << endl;
+    }
+}
+
+void test_rebuild()
+{
+    try
+    {
+        Graph<int, string> *G = generate_graph();
+
+        // Edit the vertices map directly, then refresh the CSR arrays
+        G->vertices["F"] = new Vertex<int, string>("F", 60);
+        G->get("E")->adj.push_back("F");
+        G->rebuild();
+
+        if (G->get("F") == nullptr || G->get("F")->data != 60)
+        {
+            cout << "Incorrect result getting vertex \"F\" after rebuild." << endl;
+        }
+        if (!G->reachable("E", "F"))
+        {
+            cout << "Incorrectly identified new edge target \"F\" as unreachable from \"E\" after rebuild" << endl;
+        }
+        if (!G->reachable("A", "D") || G->reachable("A", "F"))
+        {
+            cout << "Incorrect reachability after rebuild." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing rebuild : " << e.what() << endl;
+    }
+}
+
+void test_traversal_stats()
+{
+    try
+    {
+        // Chain 1 -> 2 -> 3 -> 4 -> 5
+        Graph<int, int> *G = new Graph<int, int>({1, 2, 3, 4, 5}, {1, 2, 3, 4, 5}, {{2}, {3}, {4}, {5}, {}});
+        vector<string> calls;
+        G->set_stats_hook([&](const TraversalStats &s) { calls.push_back(s.call); });
+
+        G->reachable(1, 5);
+        TraversalStats s = G->last_stats();
+        if (!Graph<int, int>::STATS_ENABLED)
+        {
+            if (!calls.empty() || s.lookups != 0 || string(s.call) != "")
+            {
+                cout << "Incorrect traversal stats without GRAPH_STATS." << endl;
+            }
+            delete G;
+            return;
+        }
+        // Both searches reach 3: forward 1, 2, 3 and backward 5, 4, 3
+        if (calls != vector<string>{"reachable"} || s.lookups != 2 || s.vertices_visited != 6 ||
+            s.edges_scanned != 4 || s.queue_peak != 1 || s.total_seconds <= 0)
+        {
+            cout << "Incorrect traversal stats for reachable." << endl;
+        }
+
+        // The second bfs() resets what the first one wrote
+        G->bfs(1);
+        G->bfs(3);
+        s = G->last_stats();
+        if (string(s.call) != "bfs" || s.vertices_reset != 5 || s.vertices_visited != 3 || s.edges_scanned != 2)
+        {
+            cout << "Incorrect traversal stats for bfs." << endl;
+        }
+
+        // Nested calls are counted under the outermost one
+        stringstream out;
+        streambuf *prevbuf = cout.rdbuf(out.rdbuf());
+        G->print_path(2, 4);
+        cout.rdbuf(prevbuf);
+        s = G->last_stats();
+        if (calls.back() != "print_path" || calls.size() != 4 || s.lookups != 2 || s.vertices_visited != 3)
+        {
+            cout << "Incorrect traversal stats for print_path." << endl;
+        }
+
+        DfsResult r = G->dfs_result();
+        s = G->last_stats();
+        if (string(s.call) != "dfs_result" || s.vertices_visited != 5 || s.edges_scanned != 4 || s.queue_peak != 5)
+        {
+            cout << "Incorrect traversal stats for dfs_result." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing traversal stats : " << e.what() << endl;
+    }
+}
+void test_scc()
+{
+    try
+    {
+        // Components {1, 2, 3}, {4, 5}, {6}; edges 3 -> 4 and 5 -> 6, 2 -> 6
+        Graph<int, int> *G = new Graph<int, int>({1, 2, 3, 4, 5, 6}, {1, 2, 3, 4, 5, 6},
+                                                 {{2}, {3, 6}, {1, 4}, {5}, {4, 6}, {}});
+        const SccResult &r = G->scc();
+        if (r.count != 3 || !G->same_component(1, 3) || !G->same_component(4, 5) || G->same_component(3, 4) ||
+            G->same_component(6, 5) || G->same_component(1, 7))
+        {
+            cout << "Incorrect strongly connected components." << endl;
+        }
+        // Reverse topological numbering: edges go from higher to lower component ids
+        int c1 = r.component[G->id_of(1)], c4 = r.component[G->id_of(4)], c6 = r.component[G->id_of(6)];
+        if (!(c1 > c4 && c4 > c6))
+        {
+            cout << "Incorrect component order." << endl;
+        }
+
+        Graph<vector<int>, int> *C = G->condensation();
+        if (C->vertices.size() != 3 || C->get(c1)->data != vector<int>{1, 2, 3} ||
+            C->get(c4)->data != vector<int>{4, 5} || C->get(c1)->adj.size() != 2 || C->get(c4)->adj.size() != 1 ||
+            !C->reachable(c1, c6) || C->reachable(c6, c1) || C->scc().count != 3)
+        {
+            cout << "Incorrect condensation." << endl;
+        }
+        delete C;
+
+        // Cached components follow updates
+        G->add_edge(6, 1);
+        if (G->scc().count != 1 || !G->same_component(6, 4))
+        {
+            cout << "Incorrect components after add_edge." << endl;
+        }
+        G->remove_vertex(6);
+        if (G->scc().count != 2 || G->scc().component[5] != -1 || G->same_component(1, 4))
+        {
+            cout << "Incorrect components after remove_vertex." << endl;
+        }
+        delete G;
+
+        // One component too deep for a recursive search
+        int n = 300000;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i;
+            edges[i] = {(i + 1) % n};
+        }
+        Graph<int, int> *D = new Graph<int, int>(keys, data, edges);
+        if (D->scc().count != 1 || !D->same_component(0, n - 1))
+        {
+            cout << "Incorrect components of a long cycle." << endl;
+        }
+        delete D;
+
+        // Threads filling the component, weight and DFS caches of one shared graph agree
+        Graph<int, int> *S = generate_int_graph(2000, 3, 9);
+        Graph<int, int> *E = generate_int_graph(2000, 3, 9);
+        vector<int> first(200);
+        for (int k = 0; k < 200; k++)
+        {
+            first[k] = E->get(k)->adj[0];
+            S->set_weight(k, first[k], 0.5);
+            E->set_weight(k, first[k], 0.5);
+        }
+        S->bfs(0);
+        E->bfs(0);
+        auto answer = [&](Graph<int, int> *H, int k) {
+            return to_string(H->same_component(k, k + 1)) + " " + to_string(H->shortest_distance(0, k)) + " " +
+                   H->edge_class(k, first[k]);
+        };
+        vector<string> shared(200);
+        vector<thread> workers;
+        for (int t = 0; t < 4; t++)
+        {
+            workers.emplace_back([&, t]() {
+                for (int k = t; k < 200; k += 4) shared[k] = answer(S, k);
+            });
+        }
+        for (thread &w : workers) w.join();
+        for (int k = 0; k < 200; k++)
+        {
+            if (shared[k] != answer(E, k))
+            {
+                cout << "Incorrect cached queries on a graph shared by threads." << endl;
+                break;
+            }
+        }
+        delete S;
+        delete E;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing scc : " << e.what() << endl;
+    }
+}
+void test_weighted_paths()
+{
+    try
+    {
+        // 1 -> 2 -> 4 is the fewest hops, 1 -> 3 -> 5 -> 4 the lightest
+        Graph<int, int> *G = new Graph<int, int>({1, 2, 3, 4, 5}, {1, 2, 3, 4, 5},
+                                                 {{2, 3}, {4}, {5}, {}, {4}},
+                                                 {{1, 1}, {10}, {2}, {}, {3}});
+        stringstream out;
+        streambuf *prevbuf = cout.rdbuf(out.rdbuf());
+        G->print_path(1, 4);
+        cout << "|";
+        G->print_shortest_path(1, 4);
+        cout.rdbuf(prevbuf);
+        if (out.str() != "1 -> 2 -> 4|1 -> 3 -> 5 -> 4" || G->shortest_distance(1, 4) != 6 ||
+            G->shortest_distance(4, 1) != numeric_limits<double>::infinity() || !G->shortest_path(4, 1).empty() ||
+            G->weight(2, 4) != 10 || G->weight(4, 2) != numeric_limits<double>::infinity())
+        {
+            cout << "Incorrect weighted shortest path." << endl;
+        }
+
+        // Weights follow set_weight() and edge updates
+        G->set_weight(2, 4, 1);
+        G->add_edge(1, 4, 2.5);
+        G->remove_edge(1, 2);
+        if (G->shortest_path(1, 4) != vector<int>{1, 4} || G->shortest_distance(1, 4) != 2.5 ||
+            G->weight(3, 5) != 2 || G->weight(1, 3) != 1 || G->set_weight(1, 2, 1) || G->set_weight(1, 3, -1))
+        {
+            cout << "Incorrect weights after updates." << endl;
+        }
+        G->remove_vertex(3);
+        if (G->weight(1, 4) != 2.5 || G->get(1)->weights.size() != G->get(1)->adj.size())
+        {
+            cout << "Incorrect weights after remove_vertex." << endl;
+        }
+        delete G;
+
+        // Unweighted graphs give hop counts
+        Graph<int, string> *H = generate_graph();
+        if (H->shortest_distance("A", "D") != 2 || H->shortest_distance("D", "B") != 3)
+        {
+            cout << "Incorrect unweighted shortest distance." << endl;
+        }
+        delete H;
+
+        // Delta-stepping (single and multi-threaded) matches Dijkstra
+        int n = 4000;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        vector<vector<double>> weights(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i;
+            for (int j = 1; j <= 5; j++)
+            {
+                edges[i].push_back((i * 31 + j * 977) % n);
+                weights[i].push_back((i * j) % 7 == 0 ? 0 : (i + j) % 13 + 0.5);
+            }
+        }
+        Graph<int, int> *W = new Graph<int, int>(keys, data, edges, weights);
+        ShortestPaths a = W->shortest_paths(0);
+        bool same = true;
+        for (unsigned threads : {1u, 4u})
+        {
+            W->set_threads(threads, 0);
+            for (double delta : {0.0, 0.25, 100.0})
+            {
+                ShortestPaths b = W->delta_stepping(0, delta);
+                for (int id = 0; id < n && same; id++)
+                {
+                    int p = b.parent(id);
+                    same = a.distance(id) == b.distance(id) &&
+                           (p < 0 || b.distance(p) + W->weight(W->key_of(p), W->key_of(id)) == b.distance(id));
+                }
+            }
+        }
+        if (!same || a.order.size() != (size_t)n || W->shortest_distance(0, n - 1) != a.distance(W->id_of(n - 1)))
+        {
+            cout << "Incorrect delta-stepping distances." << endl;
+        }
+        delete W;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing weighted paths : " << e.what() << endl;
+    }
+}
+void test_topological_sort()
+{
+    try
+    {
+        // Diamond 1 -> {2, 3} -> 4, plus 5 -> 3
+        Graph<int, int> *G = new Graph<int, int>({1, 2, 3, 4, 5}, {1, 2, 3, 4, 5}, {{2, 3}, {4}, {4}, {}, {3}});
+        vector<int> order, cycle;
+        if (!G->topological_sort(order, cycle) || order != vector<int>{1, 2, 5, 3, 4} || !cycle.empty())
+        {
+            cout << "Incorrect topological order." << endl;
+        }
+
+        // Ready vertices leave in key order, not in the order of the adj lists
+        Graph<int, string> *T = new Graph<int, string>({"A", "Y", "Z"}, {1, 2, 3}, {{"Z", "Y"}, {}, {}});
+        vector<string> tied, tied_cycle;
+        if (!T->topological_sort(tied, tied_cycle) || tied != vector<string>{"A", "Y", "Z"})
+        {
+            cout << "Incorrect topological order: ties should be broken in key order." << endl;
+        }
+        delete T;
+
+        // The reported cycle is made of real edges, 4 -> 2 -> ... -> 4
+        G->add_edge(4, 1);
+        if (G->topological_sort(order, cycle) || cycle.empty())
+        {
+            cout << "Incorrect cycle detection." << endl;
+        }
+        for (size_t i = 0; i < cycle.size(); i++)
+        {
+            if (G->weight(cycle[i], cycle[(i + 1) % cycle.size()]) != 1)
+            {
+                cout << "Incorrect cycle reported." << endl;
+            }
+        }
+        bool ran = false;
+        if (G->for_each_wavefront([&](const int &) { ran = true; }) || ran)
+        {
+            cout << "Incorrect wavefront on a cyclic graph." << endl;
+        }
+        delete G;
+
+        // Layered DAG: every callback must see all of its predecessors finished
+        int layers = 40, width = 50, n = layers * width;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i;
+            if (i + width < n)
+            {
+                edges[i] = {i + width, (i / width + 1) * width + (i * 7) % width};
+            }
+        }
+        Graph<int, int> *D = new Graph<int, int>(keys, data, edges);
+        vector<atomic<bool>> done(n);
+        atomic<int> calls{0};
+        atomic<bool> early{false};
+        bool ok = D->for_each_wavefront([&](const int &k) {
+            for (int p = 0; p < n; p++)
+            {
+                if (find(edges[p].begin(), edges[p].end(), k) != edges[p].end() && !done[p]) early = true;
+            }
+            done[k] = true;
+            calls++;
+        }, 4);
+        if (!ok || calls != n || early)
+        {
+            cout << "Incorrect wavefront order." << endl;
+        }
+        delete D;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing topological sort : " << e.what() << endl;
+    }
+}
+void test_compression()
+{
+    try
+    {
+        // Compressed rows keep the adj order, so every search on P must match
+        // the plain graph G built from the same lists
+        int n = 5000;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i * 3;
+            for (int j = 1; j <= 6; j++)
+            {
+                edges[i].push_back((i + j * j * 7 + (i % 5) * 100) % n * 3);
+            }
+            edges[i].push_back(n * 3 + 1); // Not a vertex
+        }
+        Graph<int, int> *P = new Graph<int, int>(keys, data, edges);
+        Graph<int, int> *G = new Graph<int, int>(keys, data, edges);
+
+        CompressionStats stats = P->compress();
+        if (!P->is_compressed() || stats.edges != (size_t)n * 6 || stats.ratio() < 2 ||
+            stats.compressed_bytes_per_edge() >= stats.plain_bytes_per_edge() / 2 || P->memory_usage().csr_bytes >= G->memory_usage().csr_bytes)
+        {
+            cout << "Incorrect compression stats." << endl;
+        }
+
+        bool same = true;
+        DfsResult gd = G->dfs_result();
+        DfsResult pd = P->dfs_result();
+        for (int s = 0; s < n && same; s += 173)
+        {
+            BfsResult a = G->bfs_result(s * 3);
+            BfsResult b = P->bfs_result(s * 3);
+            same = a.order == b.order && gd.discovery_time(s) == pd.discovery_time(s) && gd.finish_time(s) == pd.finish_time(s) &&
+                   G->bidirectional_path(s * 3, 3) == P->bidirectional_path(s * 3, 3) &&
+                   G->reachable(3, s * 3) == P->reachable(3, s * 3) &&
+                   G->bfs_hybrid_result(s * 3).distance(7) == P->bfs_hybrid_result(s * 3).distance(7);
+        }
+        vector<pair<int, int>> pairs;
+        for (int i = 0; i < 300; i++)
+        {
+            pairs.push_back({i * 37 % n * 3, i * 101 % n * 3});
+        }
+        stringstream gout, pout;
+        streambuf *prevbuf = cout.rdbuf(gout.rdbuf());
+        G->bfs_tree(6);
+        G->print_path(6, 900);
+        G->bfs(6);
+        cout << G->edge_class(6, edges[2][0]);
+        G->dfs(0);
+        for (const ClassifiedEdge<int> &e : G->classify_all_edges())
+        {
+            cout << e.from << "-" << e.to << ":" << e.type << " " << G->get(e.from)->discovery_time << " ";
+        }
+        cout.rdbuf(pout.rdbuf());
+        P->bfs_tree(6);
+        P->print_path(6, 900);
+        P->bfs(6);
+        cout << P->edge_class(6, edges[2][0]);
+        P->dfs(0);
+        for (const ClassifiedEdge<int> &e : P->classify_all_edges())
+        {
+            cout << e.from << "-" << e.to << ":" << e.type << " " << P->get(e.from)->discovery_time << " ";
+        }
+        cout.rdbuf(prevbuf);
+        vector<int> gorder, porder, cycle;
+        if (!same || gout.str() != pout.str() || G->distance_batch(pairs) != P->distance_batch(pairs) ||
+            G->topological_sort(gorder, cycle) != P->topological_sort(porder, cycle) || gorder != porder ||
+            !P->is_compressed() || P->get(9)->adj.size() != 7)
+        {
+            cout << "Incorrect results on compressed rows." << endl;
+        }
+
+        // Updates restore the plain rows
+        P->add_edge(0, 3);
+        if (P->is_compressed() || !P->reachable(0, 3) || P->shortest_distance(0, 3) != 1)
+        {
+            cout << "Incorrect decompression." << endl;
+        }
+        delete G;
+        delete P;
+
+        // Compressing and reordering must not shuffle the weights
+        Graph<int, int> *W = new Graph<int, int>({1, 2, 3}, {0, 0, 0}, {{3, 2}, {}, {}}, {{5, 7}, {}, {}});
+        W->compress();
+        bool compressed_ok = W->weight(1, 3) == 5 && W->weight(1, 2) == 7 && W->shortest_distance(1, 3) == 5;
+        W->compress();
+        W->reorder(VertexOrder::DEGREE);
+        if (!compressed_ok || W->weight(1, 3) != 5 || W->weight(1, 2) != 7 || W->shortest_distance(1, 2) != 7)
+        {
+            cout << "Incorrect weights after compression." << endl;
+        }
+        delete W;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing compression : " << e.what() << endl;
+    }
+}
+// Every key-level answer of G, as one string
+string key_level_results(Graph<int, int> *G, const vector<int> &keys)
+{
+    stringstream out;
+    streambuf *prevbuf = cout.rdbuf(out.rdbuf());
+    G->bfs_tree(keys[0]);
+    G->print_path(keys[0], keys[keys.size() / 2]);
+    G->print_path(keys[7], keys[3]);
+    G->bfs(keys[5]);
+    for (int k : keys)
+    {
+        out << k << ":" << G->get(k)->distance << "," << G->get(k)->pi << " ";
+    }
+    G->dfs(keys[0]);
+    for (int k : keys)
+    {
+        out << G->get(k)->discovery_time << "/" << G->get(k)->finish_time << " ";
+    }
+    for (const ClassifiedEdge<int> &e : G->classify_all_edges())
+    {
+        out << e.from << "-" << e.to << ":" << e.type << " ";
+    }
+    out << G->edge_class(keys[1], G->get(keys[1])->adj[0]) << G->reachable(keys[9], keys[2]);
+    vector<int> order, cycle;
+    out << G->topological_sort(order, cycle);
+    for (int k : cycle)
+    {
+        out << k << " ";
+    }
+    Graph<vector<int>, int> *C = G->condensation();
+    for (auto &pair : C->vertices)
+    {
+        out << pair.second->data.size() << ":" << pair.second->adj.size() << " ";
+    }
+    delete C;
+    cout.rdbuf(prevbuf);
+    return out.str();
+}
+
+// Largest id distance between the ends of an edge
+int id_bandwidth(Graph<int, int> *G)
+{
+    int band = 0;
+    for (auto &pair : G->vertices)
+    {
+        for (int v : pair.second->adj)
+        {
+            band = max(band, abs(G->id_of(pair.first) - G->id_of(v)));
+        }
+    }
+    return band;
+}
+
+void test_reorder()
+{
+    try
+    {
+        // A 30 x 30 grid whose keys are shuffled, so key order ignores the structure,
+        // plus one hub and a few one-way edges for the edge classes
+        int side = 30;
+        int n = side * side;
+        vector<int> keys(n), data(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = (i * 7919) % 10007;
+            data[i] = i;
+        }
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            if (i % side + 1 < side) edges[i].push_back(keys[i + 1]);
+            if (i + side < n) edges[i].push_back(keys[i + side]);
+            if (i % 3 == 0 && i % side > 0) edges[i].push_back(keys[i - 1]);
+            if (i % 40 == 0) edges[0].push_back(keys[i]);
+        }
+        Graph<int, int> *G = new Graph<int, int>(keys, data, edges);
+        string expected = key_level_results(G, keys);
+        int key_band = id_bandwidth(G);
+
+        Graph<int, int> *R = new Graph<int, int>(keys, data, edges);
+        VertexOrder orders[] = {VertexOrder::BFS, VertexOrder::RCM, VertexOrder::DEGREE, VertexOrder::KEYS};
+        for (VertexOrder order : orders)
+        {
+            R->reorder(order);
+            if (R->get_vertex_order() != order || key_level_results(R, keys) != expected)
+            {
+                cout << "Incorrect results after reorder " << (int)order << "." << endl;
+            }
+        }
+
+        // Compressed rows are re-encoded in each order but still visited in adj
+        // order; key_level_results() only decompresses for the condensation
+        Graph<int, int> *Z = new Graph<int, int>(keys, data, edges);
+        for (VertexOrder order : orders)
+        {
+            Z->compress();
+            Z->reorder(order);
+            if (!Z->is_compressed() || key_level_results(Z, keys) != expected)
+            {
+                cout << "Incorrect results after compress and reorder " << (int)order << "." << endl;
+            }
+        }
+        delete Z;
+
+        R->reorder(VertexOrder::RCM);
+        int rcm_band = id_bandwidth(R);
+        R->reorder(VertexOrder::DEGREE);
+        if (R->id_of(keys[0]) != 0 || rcm_band * 4 > key_band || id_bandwidth(G) != key_band)
+        {
+            cout << "Incorrect vertex order." << endl;
+        }
+
+        // Updates, compaction, snapshots and compression keep the order
+        R->reorder(VertexOrder::BFS);
+        R->remove_vertex(keys[n - 1]);
+        R->add_vertex(keys[n - 1], n - 1);
+        for (int i = 0; i < n; i++)
+        {
+            if (edges[i].size() > 0 && edges[i].back() == keys[n - 1]) R->add_edge(keys[i], keys[n - 1]);
+        }
+        R->compact();
+        string path = key_level_results(R, keys) == expected && R->save_snapshot("test_reorder.bin") ? "test_reorder.bin" : "";
+        Graph<int, int> *S = Graph<int, int>::open_snapshot(path);
+        R->compress();
+        if (S == nullptr || S->get_vertex_order() != VertexOrder::BFS || S->id_of(keys[0]) != 0 ||
+            key_level_results(S, keys) != expected || R->get_vertex_order() != VertexOrder::BFS || R->id_of(keys[0]) != 0)
+        {
+            cout << "Incorrect vertex order after updates or snapshot." << endl;
+        }
+        remove("test_reorder.bin");
+        delete S;
+        delete R;
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing reorder : " << e.what() << endl;
+    }
+}
+void test_versioned_graph()
+{
+    try
+    {
+        // Chain 0 -> 1 -> ... -> 99
+        int n = 100;
+        vector<int> keys(n), data(n);
+        vector<vector<int>> edges(n);
+        for (int i = 0; i < n; i++)
+        {
+            keys[i] = i;
+            data[i] = i * 10;
+            if (i + 1 < n) edges[i].push_back(i + 1);
+        }
+        Graph<int, int> *G = new Graph<int, int>(keys, data, edges);
+        VersionedGraph<int, int> V(*G);
+
+        // A pinned reader keeps seeing its version while updates are published
+        {
+            VersionedGraph<int, int>::Reader old = V.pin();
+            vector<GraphUpdate<int, int>> updates = {
+                {GraphUpdate<int, int>::REMOVE_EDGE, 50, 51},
+                {GraphUpdate<int, int>::ADD_VERTEX, 200, 0, 7},
+                {GraphUpdate<int, int>::ADD_EDGE, 50, 200},
+                {GraphUpdate<int, int>::ADD_EDGE, 200, 60},
+                {GraphUpdate<int, int>::ADD_EDGE, 50, 200}, // Duplicate
+                {GraphUpdate<int, int>::REMOVE_VERTEX, 99}};
+            size_t changed = V.apply(updates);
+            G->apply(updates);
+            V.add_edge(3, 1);
+            G->add_edge(3, 1);
+
+            VersionedGraph<int, int>::Reader now = V.pin();
+            stringstream out;
+            streambuf *prevbuf = cout.rdbuf(out.rdbuf());
+            old.print_path(40, 70);
+            cout << "|";
+            now.print_path(40, 70);
+            cout << "|";
+            G->print_path(40, 70);
+            cout.rdbuf(prevbuf);
+
+            bool same = true;
+            for (int u = 0; u < n && same; u += 7)
+            {
+                for (int v = 0; v < n; v += 3)
+                {
+                    same = same && now.reachable(u, v) == G->reachable(u, v) && old.reachable(u, v) == (u <= v);
+                }
+            }
+            if (changed != 5 || old.version() != 0 || now.version() != 2 || V.version() != 2 || !same ||
+                old.edge_count() != (size_t)n - 1 || now.edge_count() != (size_t)n || now.vertex_count() != (size_t)n ||
+                old.contains(200) || *now.data(200) != 7 || now.data(99) != nullptr || *old.data(99) != 990 ||
+                now.has_edge(98, 99) || !old.has_edge(98, 99) || now.neighbors(50) != vector<int>{200} ||
+                out.str() != "40 -> 41 -> 42 -> 43 -> 44 -> 45 -> 46 -> 47 -> 48 -> 49 -> 50 -> 51 -> 52 -> 53 -> 54 -> 55 -> 56 -> 57 -> 58 -> 59 -> 60 -> 61 -> 62 -> 63 -> 64 -> 65 -> 66 -> 67 -> 68 -> 69 -> 70|"
+                                 "40 -> 41 -> 42 -> 43 -> 44 -> 45 -> 46 -> 47 -> 48 -> 49 -> 50 -> 200 -> 60 -> 61 -> 62 -> 63 -> 64 -> 65 -> 66 -> 67 -> 68 -> 69 -> 70|"
+                                 "40 -> 41 -> 42 -> 43 -> 44 -> 45 -> 46 -> 47 -> 48 -> 49 -> 50 -> 200 -> 60 -> 61 -> 62 -> 63 -> 64 -> 65 -> 66 -> 67 -> 68 -> 69 -> 70" ||
+                V.retired_versions() != 2 || V.apply(updates) != 0)
+            {
+                cout << "Incorrect versioned graph snapshot." << endl;
+            }
+        }
+
+        // Both readers are gone, so the next write reclaims every old version
+        V.remove_edge(3, 1);
+        if (V.retired_versions() != 0 || V.pin().reachable(3, 1))
+        {
+            cout << "Incorrect version reclamation." << endl;
+        }
+
+        // Versions kept past one reclaim pass still free their blocks later
+        // (checked by make test-asan)
+        {
+            VersionedGraph<int, int>::Reader r = V.pin();
+            V.add_edge(5, 7);
+            V.add_edge(5, 8);
+        }
+        V.remove_edge(5, 7);
+        V.remove_edge(5, 8);
+
+        // With every slot taken, pin() sleeps until a reader lets go
+        {
+            vector<VersionedGraph<int, int>::Reader> held;
+            for (size_t i = 0; i < VersionedGraph<int, int>::READER_SLOTS; i++)
+            {
+                held.push_back(V.pin());
+            }
+            atomic<bool> pinned{false};
+            thread late([&]() {
+                VersionedGraph<int, int>::Reader r = V.pin();
+                pinned = r.contains(5);
+            });
+            this_thread::sleep_for(chrono::milliseconds(20));
+            bool waited = !pinned.load();
+            held.pop_back();
+            late.join();
+            if (!waited || !pinned.load())
+            {
+                cout << "Incorrect pin() with every reader slot taken." << endl;
+            }
+        }
+
+        // Each write swaps 10 -> 11 for 10 -> 12 or back in one version, so a
+        // reader must always find 0 -> 20 with a length that matches its version
+        V.add_edge(10, 12);
+        V.remove_edge(10, 12);
+        unsigned long base = V.version();
+        atomic<bool> done{false};
+        atomic<int> errors{0};
+        vector<thread> readers;
+        for (int t = 0; t < 4; t++)
+        {
+            readers.emplace_back([&]() {
+                while (!done.load())
+                {
+                    VersionedGraph<int, int>::Reader r = V.pin();
+                    bool skip = (r.version() - base) % 2 == 1;
+                    if (r.path(0, 20).size() != (skip ? 20u : 21u) || r.has_edge(10, 11) == skip) errors++;
+                }
+            });
+        }
+        for (int i = 0; i < 2000; i++)
+        {
+            bool skip = i % 2 == 0;
+            V.apply({{skip ? GraphUpdate<int, int>::ADD_EDGE : GraphUpdate<int, int>::REMOVE_EDGE, 10, 12},
+                     {skip ? GraphUpdate<int, int>::REMOVE_EDGE : GraphUpdate<int, int>::ADD_EDGE, 10, 11}});
+        }
+        done = true;
+        for (thread &t : readers)
+        {
+            t.join();
+        }
+        V.add_edge(0, 20);
+        if (errors.load() != 0 || V.version() != base + 2001 || V.retired_versions() != 0)
+        {
+            cout << "Incorrect concurrent versioned reads." << endl;
+        }
+        delete G;
+    }
+    catch (exception &e)
+    {
+        cerr << "Error testing versioned graph : " << e.what() << endl;
+    }
+}
 int main()
 {
     string file_name = "Student Custom Tests <int, string>";
@@ -246,9 +1979,31 @@ int main()
     test_bfs(G);
     test_print_path(G);
     test_bfs_tree(G);
+    test_query_results(G);
+    test_reachable_batch(G);
     
     // Edge class needs specific structure to guarantee types, so we use a helper
     test_edge_class_custom();
+    test_classify_all_edges();
+    test_rebuild();
+    test_dynamic_updates();
+    test_memory_usage();
+    test_key_index();
+    test_dense_keys();
+    test_traversal_stats();
+    test_bfs_hybrid();
+    test_parallel_bfs();
+    test_reachability_index();
+    test_scc();
+    test_weighted_paths();
+    test_topological_sort();
+    test_compression();
+    test_reorder();
+    test_versioned_graph();
+    test_deep_dfs();
+    test_bidirectional_path();
+    test_load_adjacency_list();
+    test_snapshot();
 
     cout << "Testing completed" << endl;
 
@@ -0,0 +1,136 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+// Fixed set of worker threads running parallel-for batches.
+// Several callers may submit batches at the same time.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threads = thread::hardware_concurrency())
+    {
+        for (unsigned i = 0; i < threads; i++)
+        {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        work_cv.notify_all();
+        for (thread &t : workers)
+        {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Runs fn(0) .. fn(tasks - 1) and returns once all of them have finished.
+    // The calling thread runs tasks too, so run() may be nested inside a task.
+    void run(size_t tasks, const function<void(size_t)> &fn)
+    {
+        if (tasks == 0) return;
+
+        auto b = make_shared<Batch>();
+        b->fn = &fn;
+        b->tasks = tasks;
+        if (tasks > 1 && !workers.empty())
+        {
+            {
+                lock_guard<mutex> lock(m);
+                batches.push_back(b);
+            }
+            work_cv.notify_all();
+        }
+
+        work_on(*b);
+
+        unique_lock<mutex> lock(m);
+        done_cv.wait(lock, [&] { return b->done.load() == b->tasks; });
+        auto it = find(batches.begin(), batches.end(), b);
+        if (it != batches.end()) batches.erase(it);
+    }
+
+    // Number of worker threads (not counting callers of run())
+    unsigned size() const { return workers.size(); }
+
+    // Process-wide pool with one worker per core
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    struct Batch
+    {
+        const function<void(size_t)> *fn = nullptr;
+        size_t tasks = 0;
+        atomic<size_t> next{0}; // Next task index to hand out
+        atomic<size_t> done{0}; // Finished tasks
+    };
+
+    void work_on(Batch &b)
+    {
+        for (;;)
+        {
+            size_t i = b.next.fetch_add(1);
+            if (i >= b.tasks) return;
+
+            (*b.fn)(i);
+
+            if (b.done.fetch_add(1) + 1 == b.tasks)
+            {
+                lock_guard<mutex> lock(m);
+                done_cv.notify_all();
+            }
+        }
+    }
+
+    void worker_loop()
+    {
+        for (;;)
+        {
+            shared_ptr<Batch> b;
+            {
+                unique_lock<mutex> lock(m);
+                work_cv.wait(lock, [&] { return stopping || !batches.empty(); });
+                if (batches.empty()) return; // stopping
+
+                b = batches.front();
+                if (b->next.load() >= b->tasks)
+                {
+                    batches.pop_front(); // Every task handed out
+                    continue;
+                }
+            }
+            work_on(*b);
+        }
+    }
+
+    vector<thread> workers;
+    deque<shared_ptr<Batch>> batches;
+    mutex m;
+    condition_variable work_cv;
+    condition_variable done_cv;
+    bool stopping = false;
+};
+
+#endif // THREAD_POOL_H